@@ -0,0 +1,233 @@
+#include "DebugSink.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <vector>
+
+static const char *
+getSeverityName(VkDebugUtilsMessageSeverityFlagBitsEXT severity) {
+    switch (severity) {
+        case VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT: return "verbose";
+        case VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT:    return "info";
+        case VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT: return "warning";
+        case VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT:   return "error";
+        default:                                              return "-";
+    }
+}
+
+static const char *
+getTypeName(VkDebugUtilsMessageTypeFlagsEXT type) {
+    switch (type) {
+        case VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT:     return "general";
+        case VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT:  return "validation";
+        case VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT: return "performance";
+        default:                                              return "-";
+    }
+}
+
+/* Message IDs are hashes; print them the way the validation layers do */
+static std::ostream&
+writeMessageId(std::ostream& out, int32_t messageId) {
+    return out << "0x" << std::hex << std::setw(8) << std::setfill('0')
+               << static_cast<uint32_t>(messageId) << std::dec << std::setfill(' ');
+}
+
+DebugSink::DebugSink(std::ostream& out, size_t capacity) : out(out) {
+    size_t slotCount = 1;
+    while (slotCount < std::max<size_t>(capacity, 2)) slotCount <<= 1;
+
+    slots = std::make_unique<Slot[]>(slotCount);
+    slotMask = slotCount - 1;
+    for (size_t i = 0; i < slotCount; ++i)
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+
+    counters = std::make_unique<Counter[]>(COUNTER_TABLE_SIZE);
+
+    logger = std::thread(&DebugSink::loggerLoop, this);
+}
+
+DebugSink::~DebugSink() {
+    stopping.store(true);
+    wakeUp.notify_one();
+    logger.join();
+
+    writeSummary();
+}
+
+void
+DebugSink::push(VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+                VkDebugUtilsMessageTypeFlagsEXT type, int32_t messageId, const char *message) {
+    /* Past its first few occurrences, an ID only counts; the logger reports the total */
+    Counter *counter = findCounter(getCounterKey(messageId, message));
+    if (counter != nullptr &&
+            counter->count.fetch_add(1, std::memory_order_relaxed) >= MAX_REPEATS_PER_ID)
+        return;
+
+    /* Claim a slot by moving the enqueue position past it */
+    size_t position = enqueuePosition.load(std::memory_order_relaxed);
+    Slot *slot;
+    for (;;) {
+        slot = &slots[position & slotMask];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        auto difference = static_cast<std::ptrdiff_t>(sequence - position);
+
+        if (difference == 0) {
+            if (enqueuePosition.compare_exchange_weak(position, position + 1,
+                                                      std::memory_order_relaxed))
+                break;
+        } else if (difference < 0) {
+            /* The logger has not emptied this slot since the last lap: full */
+            droppedCount.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else
+            position = enqueuePosition.load(std::memory_order_relaxed);
+    }
+
+    slot->message.severity = severity;
+    slot->message.type = type;
+    slot->message.messageId = messageId;
+    size_t length = message != nullptr ? strnlen(message, MAX_MESSAGE_LENGTH - 1) : 0;
+    if (length != 0) memcpy(slot->message.text, message, length);
+    slot->message.text[length] = '\0';
+
+    /* Publish the message to the logger */
+    slot->sequence.store(position + 1, std::memory_order_release);
+    wakeUp.notify_one();
+}
+
+int64_t
+DebugSink::getCounterKey(int32_t messageId, const char *message) {
+    /* Zero-extended, so negative IDs never carry TEXT_KEY_BIT */
+    if (messageId != 0 || message == nullptr) return static_cast<uint32_t>(messageId);
+
+    /* FNV-1a over the part of the text that would be queued */
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < MAX_MESSAGE_LENGTH - 1 && message[i] != '\0'; ++i)
+        hash = (hash ^ static_cast<unsigned char>(message[i])) * 16777619u;
+    return TEXT_KEY_BIT | hash;
+}
+
+std::ostream&
+DebugSink::writeCounterKey(std::ostream& out, int64_t key) {
+    if (key & TEXT_KEY_BIT) {
+        writeMessageId(out, 0) << " (text ";
+        return writeMessageId(out, static_cast<int32_t>(key)) << ")";
+    }
+    return writeMessageId(out, static_cast<int32_t>(key));
+}
+
+DebugSink::Counter *
+DebugSink::findCounter(int64_t key) {
+    /* Open addressing with linear probing; entries are only ever added */
+    size_t start = (static_cast<uint32_t>(key) * 2654435761u) & (COUNTER_TABLE_SIZE - 1);
+    for (size_t i = 0; i < COUNTER_TABLE_SIZE; ++i) {
+        Counter& counter = counters[(start + i) & (COUNTER_TABLE_SIZE - 1)];
+
+        int64_t current = counter.key.load(std::memory_order_acquire);
+        if (current == EMPTY_ID &&
+                counter.key.compare_exchange_strong(current, key, std::memory_order_acq_rel))
+            return &counter;
+        /* Also covers losing the race above to a producer with the same key */
+        if (current == key) return &counter;
+    }
+
+    return nullptr;
+}
+
+bool
+DebugSink::drain() {
+    bool wroteAny = false;
+    for (;;) {
+        Slot& slot = slots[dequeuePosition & slotMask];
+        if (slot.sequence.load(std::memory_order_acquire) != dequeuePosition + 1) break;
+
+        const Message& message = slot.message;
+        out << "[" << getSeverityName(message.severity) << "] "
+            << "[" << getTypeName(message.type) << "] "
+            << "Validation layer: "
+            << message.text
+            << '\n';
+
+        /* Hand the slot back to producers for the next lap */
+        slot.sequence.store(dequeuePosition + slotMask + 1, std::memory_order_release);
+        ++dequeuePosition;
+        wroteAny = true;
+    }
+
+    return wroteAny;
+}
+
+void
+DebugSink::reportRepeats() {
+    for (size_t i = 0; i < COUNTER_TABLE_SIZE; ++i) {
+        Counter& counter = counters[i];
+        int64_t key = counter.key.load(std::memory_order_acquire);
+        if (key == EMPTY_ID) continue;
+
+        uint64_t count = counter.count.load(std::memory_order_relaxed);
+        uint64_t reported = std::max(counter.reported, MAX_REPEATS_PER_ID);
+        if (count <= reported) continue;
+
+        out << "[repeated] Validation message ";
+        writeCounterKey(out, key)
+            << " occurred " << count - reported << " more time(s), " << count << " in total\n";
+        counter.reported = count;
+    }
+
+    uint64_t dropped = droppedCount.load(std::memory_order_relaxed);
+    if (dropped != reportedDropCount) {
+        out << "[dropped] " << dropped - reportedDropCount
+            << " validation message(s) lost to a full queue\n";
+        reportedDropCount = dropped;
+    }
+}
+
+void
+DebugSink::writeSummary() {
+    std::vector<std::pair<int64_t, uint64_t>> totals;
+    for (size_t i = 0; i < COUNTER_TABLE_SIZE; ++i) {
+        int64_t key = counters[i].key.load(std::memory_order_acquire);
+        if (key != EMPTY_ID)
+            totals.emplace_back(key, counters[i].count.load(std::memory_order_relaxed));
+    }
+    if (totals.empty()) return;
+
+    /* Most frequent first */
+    std::sort(totals.begin(), totals.end(), [](const auto& a, const auto& b) {
+        return a.second > b.second;
+    });
+
+    out << "Validation messages by ID:\n";
+    for (const auto& [key, count] : totals) {
+        out << "  ";
+        writeCounterKey(out, key) << ": " << count << "\n";
+    }
+    out.flush();
+}
+
+void
+DebugSink::loggerLoop() {
+    auto lastReport = std::chrono::steady_clock::now();
+
+    for (;;) {
+        /* Read the flag first so that nothing queued before stopping is missed */
+        bool stop = stopping.load();
+
+        bool wrote = drain();
+        auto now = std::chrono::steady_clock::now();
+        if (stop || now - lastReport >= REPORT_INTERVAL) {
+            reportRepeats();
+            lastReport = now;
+            wrote = true;
+        }
+        if (wrote) out.flush();
+
+        if (stop) return;
+
+        /* Producers notify without the lock so they never block; a wake-up lost that way
+         * only delays the messages until the timeout */
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeUp.wait_for(lock, std::chrono::milliseconds(50));
+    }
+}
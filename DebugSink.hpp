@@ -0,0 +1,104 @@
+#ifndef DEBUG_SINK_H
+#define DEBUG_SINK_H
+
+#include "vulkan/vulkan_core.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+
+/* Takes debug messenger messages off the thread that reported them and writes them out on a
+ * logger thread of its own, so a validation error in a hot loop costs the reporting thread a
+ * copy rather than a locked, flushed write to the terminal.
+ *
+ * Producers hand messages over through a bounded lock-free queue; a message is dropped, and
+ * counted, when the queue is full. Every message ID has a counter: the first
+ * MAX_REPEATS_PER_ID messages of an ID are queued in full, later ones only bump the counter
+ * and the logger reports them as a single "repeated" line at most once per REPORT_INTERVAL.
+ * The loader, drivers and many general messages all report ID 0, so those are counted by a
+ * hash of their text instead. The destructor writes out what is left, then a count per ID. */
+class DebugSink {
+    public:
+        explicit DebugSink(std::ostream& out = std::cerr, size_t capacity = DEFAULT_CAPACITY);
+        ~DebugSink();
+
+        DebugSink(const DebugSink&) = delete;
+        DebugSink& operator=(const DebugSink&) = delete;
+
+        /* Hand a message to the logger; safe to call from any thread, never blocks */
+        void push(VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+                  VkDebugUtilsMessageTypeFlagsEXT type, int32_t messageId, const char *message);
+
+        /* Messages lost because the queue was full */
+        uint64_t getDroppedCount() const { return droppedCount.load(std::memory_order_relaxed); }
+
+        /* Rounded up to a power of two */
+        static const size_t DEFAULT_CAPACITY = 256;
+        /* Longer messages are cut short */
+        static const size_t MAX_MESSAGE_LENGTH = 2048;
+        static constexpr uint64_t MAX_REPEATS_PER_ID = 3;
+        static constexpr std::chrono::milliseconds REPORT_INTERVAL { 1000 };
+
+    private:
+        struct Message {
+            VkDebugUtilsMessageSeverityFlagBitsEXT severity;
+            VkDebugUtilsMessageTypeFlagsEXT type;
+            int32_t messageId;
+            char text[MAX_MESSAGE_LENGTH];
+        };
+        /* A queue slot. Its sequence equals the enqueue position it is free for, or that
+         * position + 1 once a message has been written to it */
+        struct Slot {
+            std::atomic<size_t> sequence;
+            Message message;
+        };
+        /* How often a message was reported. Entries are claimed for good by the first
+         * producer to see a key and are never removed */
+        struct Counter {
+            std::atomic<int64_t> key { EMPTY_ID }; /* See getCounterKey() */
+            std::atomic<uint64_t> count { 0 };
+            uint64_t reported = 0; /* Logger only: count as of the last "repeated" line */
+        };
+
+        static const int64_t EMPTY_ID = INT64_MIN;
+        /* Set in the keys of ID 0 messages, whose low 32 bits are a hash of the text */
+        static const int64_t TEXT_KEY_BIT = int64_t(1) << 32;
+        static const size_t COUNTER_TABLE_SIZE = 1024; /* A power of two */
+
+        std::ostream& out;
+
+        std::unique_ptr<Slot[]> slots;
+        size_t slotMask;
+        std::atomic<size_t> enqueuePosition { 0 };
+        size_t dequeuePosition = 0; /* Logger only */
+
+        std::unique_ptr<Counter[]> counters;
+        std::atomic<uint64_t> droppedCount { 0 };
+        uint64_t reportedDropCount = 0; /* Logger only */
+
+        std::atomic<bool> stopping { false };
+        std::mutex sleepMutex;
+        std::condition_variable wakeUp;
+        std::thread logger;
+
+        /* The message ID, or for ID 0 a hash of the text tagged with TEXT_KEY_BIT */
+        static int64_t getCounterKey(int32_t messageId, const char *message);
+        static std::ostream& writeCounterKey(std::ostream& out, int64_t key);
+        /* The counter of a key, claiming one if needed; nullptr if the table is full */
+        Counter *findCounter(int64_t key);
+        /* Write out every queued message; false if there was none */
+        bool drain();
+        /* Write a line for each ID repeated since the last report, and for dropped messages */
+        void reportRepeats();
+        void writeSummary();
+        void loggerLoop();
+};
+
+#endif
@@ -0,0 +1,319 @@
+#include "DeviceAllocator.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <stdexcept>
+
+/* Round offset up to a multiple of alignment (a power of two, as Vulkan guarantees) */
+static VkDeviceSize alignUp(VkDeviceSize offset, VkDeviceSize alignment) {
+    return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+DeviceAllocator::DeviceAllocator(VkPhysicalDevice physicalDevice, VkDevice device,
+                                 const VkAllocationCallbacks *allocator, VkDeviceSize blockSize)
+        : device(device), allocator(allocator), blockSize(blockSize) {
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+}
+
+DeviceAllocator::~DeviceAllocator() {
+    for (auto& block : blocks)
+        if (block.memory != VK_NULL_HANDLE) destroyBlock(block);
+}
+
+DeviceAllocation
+DeviceAllocator::allocate(const VkMemoryRequirements& requirements,
+                          VkMemoryPropertyFlags properties, bool linear) {
+    uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+    std::lock_guard<std::mutex> lock(mutex);
+
+    DeviceAllocation allocation;
+
+    /* Anything taking up a good part of a block gets a block of its own */
+    if (requirements.size > getBlockSize(memoryType) / 2) {
+        uint32_t index = createBlock(requirements.size, memoryType, linear);
+        Block& block = blocks[index];
+        block.dedicated = true;
+        block.freeRanges.clear();
+        block.allocationCount = 1;
+
+        allocation.memory = block.memory;
+        allocation.size = requirements.size;
+        allocation.mapped = block.mapped;
+        allocation.block = index;
+        return allocation;
+    }
+
+    for (uint32_t index = 0; index < blocks.size(); ++index) {
+        const Block& block = blocks[index];
+        if (block.memory == VK_NULL_HANDLE || block.arena || block.dedicated ||
+                block.memoryType != memoryType || block.linear != linear)
+            continue;
+        if (allocateFromBlock(index, requirements, allocation)) return allocation;
+    }
+
+    /* Every block of the pool is full (or too fragmented), so grow it */
+    uint32_t index = createBlock(getBlockSize(memoryType), memoryType, linear);
+    if (!allocateFromBlock(index, requirements, allocation))
+        throw std::runtime_error("Failed to sub-allocate device memory.");
+
+    return allocation;
+}
+
+void
+DeviceAllocator::free(const DeviceAllocation& allocation) {
+    if (allocation.memory == VK_NULL_HANDLE) return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    Block& block = blocks[allocation.block];
+
+    if (block.dedicated) {
+        destroyBlock(block);
+        return;
+    }
+
+    /* Put the range back, merging it with the holes on either side. Empty blocks are kept
+     * around for later allocations */
+    auto next = block.freeRanges.emplace(allocation.offset, allocation.size).first;
+    if (next != block.freeRanges.begin()) {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == next->first) {
+            previous->second += next->second;
+            block.freeRanges.erase(next);
+            next = previous;
+        }
+    }
+    auto following = std::next(next);
+    if (following != block.freeRanges.end() && next->first + next->second == following->first) {
+        next->second += following->second;
+        block.freeRanges.erase(following);
+    }
+
+    --block.allocationCount;
+}
+
+uint32_t
+DeviceAllocator::createArena(VkDeviceSize size, uint32_t memoryTypeBits,
+                             VkMemoryPropertyFlags properties) {
+    uint32_t memoryType = findMemoryType(memoryTypeBits, properties);
+    std::lock_guard<std::mutex> lock(mutex);
+
+    uint32_t index = createBlock(size, memoryType, true);
+    blocks[index].arena = true;
+    blocks[index].freeRanges.clear();
+    return index;
+}
+
+DeviceAllocation
+DeviceAllocator::allocateLinear(uint32_t arena, const VkMemoryRequirements& requirements) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Block& block = blocks[arena];
+
+    if (!(requirements.memoryTypeBits & (1u << block.memoryType)))
+        throw std::runtime_error("Failed to allocate from arena: incompatible memory type.");
+
+    VkDeviceSize offset = alignUp(block.head, requirements.alignment);
+    if (offset + requirements.size > block.size)
+        throw std::runtime_error("Failed to allocate from arena: arena is full.");
+
+    block.head = offset + requirements.size;
+    block.peakHead = std::max(block.peakHead, block.head);
+    ++block.allocationCount;
+
+    DeviceAllocation allocation;
+    allocation.memory = block.memory;
+    allocation.offset = offset;
+    allocation.size = requirements.size;
+    allocation.mapped = block.mapped ? static_cast<char*>(block.mapped) + offset : nullptr;
+    allocation.block = arena;
+    return allocation;
+}
+
+void
+DeviceAllocator::resetArena(uint32_t arena) {
+    std::lock_guard<std::mutex> lock(mutex);
+    blocks[arena].head = 0;
+    blocks[arena].allocationCount = 0;
+}
+
+DeviceAllocation
+DeviceAllocator::getArenaMemory(uint32_t arena) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    const Block& block = blocks[arena];
+
+    DeviceAllocation allocation;
+    allocation.memory = block.memory;
+    allocation.size = block.size;
+    allocation.mapped = block.mapped;
+    allocation.block = arena;
+    return allocation;
+}
+
+uint32_t
+DeviceAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const {
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
+        if ((typeFilter & (1u << i)) &&
+                (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+            return i;
+
+    throw std::runtime_error("Failed to find a suitable memory type.");
+}
+
+DeviceAllocatorStats
+DeviceAllocator::getStats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    DeviceAllocatorStats stats {};
+    VkDeviceSize freeBytes = 0;
+    VkDeviceSize largestPerBlock = 0; /* Sum of each pooled block's largest hole */
+
+    for (const auto& block : blocks) {
+        if (block.memory == VK_NULL_HANDLE) continue;
+
+        ++stats.blockCount;
+        stats.reservedBytes += block.size;
+
+        if (block.arena) {
+            stats.usedBytes += block.head;
+            ++stats.arenaCount;
+            stats.arenaPeakBytes += block.peakHead;
+        } else if (block.dedicated) {
+            stats.usedBytes += block.size;
+            ++stats.allocationCount;
+        } else {
+            VkDeviceSize blockFree = 0, blockLargest = 0;
+            for (const auto& range : block.freeRanges) {
+                blockFree += range.second;
+                blockLargest = std::max(blockLargest, range.second);
+            }
+            stats.largestFreeRange = std::max(stats.largestFreeRange, blockLargest);
+            largestPerBlock += blockLargest;
+            stats.usedBytes += block.size - blockFree;
+            stats.allocationCount += block.allocationCount;
+            stats.freeRangeCount += block.freeRanges.size();
+            freeBytes += blockFree;
+        }
+    }
+
+    stats.fragmentation = freeBytes == 0 ? 0.0 :
+            1.0 - double(largestPerBlock) / double(freeBytes);
+    return stats;
+}
+
+void
+DeviceAllocator::writeStats(std::ostream& out) const {
+    DeviceAllocatorStats stats = getStats();
+    const double MiB = 1024.0 * 1024.0;
+
+    out << std::fixed << std::setprecision(2)
+        << "Device memory: " << stats.usedBytes / MiB << " of " << stats.reservedBytes / MiB
+        << " MiB used in " << stats.blockCount << " blocks, " << stats.allocationCount
+        << " pooled allocations, " << stats.freeRangeCount << " holes (largest "
+        << stats.largestFreeRange / MiB << " MiB, fragmentation "
+        << stats.fragmentation * 100.0 << "%)\n";
+    if (stats.arenaCount > 0)
+        out << "Arenas: " << stats.arenaCount << ", peak usage between resets "
+            << stats.arenaPeakBytes / 1024.0 << " KiB\n";
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        const Block& block = blocks[i];
+        if (block.memory == VK_NULL_HANDLE) continue;
+
+        VkDeviceSize used = block.head;
+        if (block.dedicated) used = block.size;
+        else if (!block.arena) {
+            used = block.size;
+            for (const auto& range : block.freeRanges) used -= range.second;
+        }
+
+        out << "  block " << std::setw(3) << i << ": type " << std::setw(2) << block.memoryType
+            << (block.arena ? " arena    " : block.dedicated ? " dedicated" :
+                block.linear ? " linear   " : " optimal  ")
+            << std::setw(10) << used / MiB << " / " << std::setw(8) << block.size / MiB
+            << " MiB\n";
+    }
+
+    out << std::defaultfloat;
+}
+
+uint32_t
+DeviceAllocator::createBlock(VkDeviceSize size, uint32_t memoryType, bool linear) {
+    VkMemoryAllocateInfo allocInfo {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+
+    Block block;
+    if (vkAllocateMemory(device, &allocInfo, allocator, &block.memory) != VK_SUCCESS)
+        throw std::runtime_error("Failed to allocate device memory block.");
+
+    block.size = size;
+    block.memoryType = memoryType;
+    block.linear = linear;
+    block.freeRanges.emplace(0, size);
+
+    /* Keep host-visible blocks mapped, mapping is not free and a block can be mapped only once */
+    if (memoryProperties.memoryTypes[memoryType].propertyFlags &
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+        if (vkMapMemory(device, block.memory, 0, VK_WHOLE_SIZE, 0, &block.mapped) != VK_SUCCESS)
+            throw std::runtime_error("Failed to map device memory block.");
+
+    /* Reuse the slot of a destroyed block if there is one */
+    for (uint32_t index = 0; index < blocks.size(); ++index)
+        if (blocks[index].memory == VK_NULL_HANDLE) {
+            blocks[index] = std::move(block);
+            return index;
+        }
+
+    blocks.push_back(std::move(block));
+    return static_cast<uint32_t>(blocks.size() - 1);
+}
+
+void
+DeviceAllocator::destroyBlock(Block& block) {
+    /* Freeing memory implicitly unmaps it */
+    vkFreeMemory(device, block.memory, allocator);
+    block = Block();
+}
+
+bool
+DeviceAllocator::allocateFromBlock(uint32_t index, const VkMemoryRequirements& requirements,
+                                   DeviceAllocation& allocation) {
+    Block& block = blocks[index];
+
+    /* Best fit: the smallest hole that still holds the aligned allocation */
+    auto best = block.freeRanges.end();
+    VkDeviceSize bestOffset = 0;
+    for (auto it = block.freeRanges.begin(); it != block.freeRanges.end(); ++it) {
+        VkDeviceSize offset = alignUp(it->first, requirements.alignment);
+        if (offset + requirements.size > it->first + it->second) continue;
+        if (best == block.freeRanges.end() || it->second < best->second) {
+            best = it;
+            bestOffset = offset;
+        }
+    }
+    if (best == block.freeRanges.end()) return false;
+
+    /* Split the hole; padding in front stays a (small) hole of its own */
+    VkDeviceSize holeStart = best->first;
+    VkDeviceSize holeEnd = best->first + best->second;
+    VkDeviceSize end = bestOffset + requirements.size;
+    block.freeRanges.erase(best);
+    if (bestOffset > holeStart) block.freeRanges.emplace(holeStart, bestOffset - holeStart);
+    if (holeEnd > end) block.freeRanges.emplace(end, holeEnd - end);
+    ++block.allocationCount;
+
+    allocation.memory = block.memory;
+    allocation.offset = bestOffset;
+    allocation.size = requirements.size;
+    allocation.mapped = block.mapped ? static_cast<char*>(block.mapped) + bestOffset : nullptr;
+    allocation.block = index;
+    return true;
+}
+
+VkDeviceSize
+DeviceAllocator::getBlockSize(uint32_t memoryType) const {
+    /* Don't let a single block claim more than an eighth of a small heap */
+    uint32_t heap = memoryProperties.memoryTypes[memoryType].heapIndex;
+    return std::min(blockSize, memoryProperties.memoryHeaps[heap].size / 8);
+}
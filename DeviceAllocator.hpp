@@ -0,0 +1,120 @@
+#ifndef DEVICE_ALLOCATOR_H
+#define DEVICE_ALLOCATOR_H
+
+#include "vulkan/vulkan_core.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+/* A range of a device memory block handed out by the DeviceAllocator */
+struct DeviceAllocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE; /* The block the range lives in */
+    VkDeviceSize offset = 0;                /* Where the range starts within the block */
+    VkDeviceSize size = 0;
+    void *mapped = nullptr; /* Host address of the range if its memory is host visible */
+    uint32_t block = 0;     /* Index of the block within the allocator */
+};
+
+/* Memory usage, summed over every block of the allocator */
+struct DeviceAllocatorStats {
+    size_t blockCount;         /* vkAllocateMemory calls currently live */
+    VkDeviceSize reservedBytes; /* Total size of all blocks */
+    VkDeviceSize usedBytes;     /* Bytes handed out, alignment padding included */
+    size_t allocationCount;    /* Pooled allocations currently live */
+    size_t freeRangeCount;     /* Holes in the pooled blocks */
+    VkDeviceSize largestFreeRange;
+    /* 1 - (largest hole of each block, summed) / free pooled bytes: 0 when the free space of
+     * every block is contiguous, toward 1 when it is scattered over many small holes */
+    double fragmentation;
+    size_t arenaCount;           /* Linear arenas, counted in blockCount too */
+    VkDeviceSize arenaPeakBytes; /* Most bytes ever handed out by the arenas between resets */
+};
+
+/* Carves a few large device memory blocks into many small allocations, rather than calling
+ * vkAllocateMemory for every resource (which is slow, and capped by maxMemoryAllocationCount).
+ *
+ * Blocks belong either to a pool or to a linear arena. Pools keep a free list per block and
+ * serve allocate()/free() in any order; there is one pool per memory type and resource kind,
+ * so linear and optimal-tiling resources never share a block and bufferImageGranularity never
+ * comes into play. Arenas only bump a pointer and are reset as a whole, which suits data
+ * that lives for one frame. Host-visible blocks stay mapped for their whole lifetime.
+ * All functions are thread safe. */
+class DeviceAllocator {
+    public:
+        /* allocator is passed to Vulkan when allocating and freeing the blocks */
+        DeviceAllocator(VkPhysicalDevice physicalDevice, VkDevice device,
+                        const VkAllocationCallbacks *allocator = nullptr,
+                        VkDeviceSize blockSize = DEFAULT_BLOCK_SIZE);
+        ~DeviceAllocator();
+
+        DeviceAllocator(const DeviceAllocator&) = delete;
+        DeviceAllocator& operator=(const DeviceAllocator&) = delete;
+
+        /* Allocate memory for a resource with the given requirements from a pool; linear is
+         * false only for images with optimal tiling */
+        DeviceAllocation allocate(const VkMemoryRequirements& requirements,
+                                  VkMemoryPropertyFlags properties, bool linear = true);
+        /* Return an allocation made by allocate() to its pool */
+        void free(const DeviceAllocation& allocation);
+
+        /* Create an arena of a given size for linear resources, returning its handle; it lives
+         * as long as the allocator */
+        uint32_t createArena(VkDeviceSize size, uint32_t memoryTypeBits,
+                             VkMemoryPropertyFlags properties);
+        /* Allocate from an arena; throws if the arena is full */
+        DeviceAllocation allocateLinear(uint32_t arena, const VkMemoryRequirements& requirements);
+        /* Release everything allocated from an arena at once */
+        void resetArena(uint32_t arena);
+        /* The whole memory of an arena, to bind a buffer spanning it to; the offsets of its
+         * allocations are then offsets into that buffer as well */
+        DeviceAllocation getArenaMemory(uint32_t arena) const;
+
+        /* Pick the first allowed memory type that has all the requested properties */
+        uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+
+        DeviceAllocatorStats getStats() const;
+        /* Print usage and fragmentation per block */
+        void writeStats(std::ostream& out) const;
+
+        static const VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull << 20;
+
+    private:
+        struct Block {
+            VkDeviceMemory memory = VK_NULL_HANDLE;
+            VkDeviceSize size = 0;
+            void *mapped = nullptr;
+            uint32_t memoryType = 0;
+            bool linear = true;
+            bool dedicated = false; /* Holds a single allocation too large to pool */
+            bool arena = false;
+            /* Pooled blocks: offset -> size of each hole, coalesced on free */
+            std::map<VkDeviceSize, VkDeviceSize> freeRanges;
+            size_t allocationCount = 0;
+            /* Arena blocks: bump offset, and the furthest it got before a reset */
+            VkDeviceSize head = 0;
+            VkDeviceSize peakHead = 0;
+        };
+
+        VkDevice device;
+        const VkAllocationCallbacks *allocator;
+        VkDeviceSize blockSize;
+        VkPhysicalDeviceMemoryProperties memoryProperties;
+
+        mutable std::mutex mutex;
+        std::vector<Block> blocks; /* Freed blocks leave an empty slot, so indices stay valid */
+
+        /* Allocate a new block and return its index */
+        uint32_t createBlock(VkDeviceSize size, uint32_t memoryType, bool linear);
+        void destroyBlock(Block& block);
+        /* Try to place an allocation in a pooled block */
+        bool allocateFromBlock(uint32_t index, const VkMemoryRequirements& requirements,
+                               DeviceAllocation& allocation);
+        /* Block size to use for a memory type, smaller on small heaps */
+        VkDeviceSize getBlockSize(uint32_t memoryType) const;
+};
+
+#endif
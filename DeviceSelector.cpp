@@ -0,0 +1,181 @@
+#include "DeviceSelector.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+bool
+DeviceInfo::hasExtension(const char *name) const {
+    return std::any_of(extensions.begin(), extensions.end(),
+            [name](const VkExtensionProperties& extension) {
+                return strcmp(extension.extensionName, name) == 0;
+            });
+}
+
+std::optional<uint32_t>
+DeviceInfo::findQueueFamily(VkQueueFlags flags, VkQueueFlags excluded) const {
+    for (uint32_t family = 0; family < queueFamilies.size(); ++family) {
+        VkQueueFlags familyFlags = queueFamilies[family].queueFlags;
+        if ((familyFlags & flags) == flags && !(familyFlags & excluded)) return family;
+    }
+
+    return std::nullopt;
+}
+
+VkDeviceSize
+DeviceInfo::getDeviceLocalBytes() const {
+    VkDeviceSize largest = 0;
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; ++i)
+        if (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+            largest = std::max(largest, memoryProperties.memoryHeaps[i].size);
+
+    return largest;
+}
+
+DeviceSelector::DeviceSelector(VkInstance instance, VkSurfaceKHR surface) {
+    uint32_t deviceCount = 0;
+    vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+
+    if (deviceCount == 0)
+        throw std::runtime_error("Failed to find any GPUs with Vulkan support.");
+
+    std::vector<VkPhysicalDevice> handles(deviceCount);
+    vkEnumeratePhysicalDevices(instance, &deviceCount, handles.data());
+
+    devices.resize(deviceCount);
+    for (uint32_t i = 0; i < deviceCount; ++i) {
+        DeviceInfo& info = devices[i];
+        info.device = handles[i];
+        info.index = i;
+
+        vkGetPhysicalDeviceProperties(info.device, &info.properties);
+        vkGetPhysicalDeviceFeatures(info.device, &info.features);
+        vkGetPhysicalDeviceMemoryProperties(info.device, &info.memoryProperties);
+
+        uint32_t count = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(info.device, &count, nullptr);
+        info.queueFamilies.resize(count);
+        vkGetPhysicalDeviceQueueFamilyProperties(info.device, &count, info.queueFamilies.data());
+
+        count = 0;
+        vkEnumerateDeviceExtensionProperties(info.device, nullptr, &count, nullptr);
+        info.extensions.resize(count);
+        vkEnumerateDeviceExtensionProperties(info.device, nullptr, &count, info.extensions.data());
+
+        if (surface == VK_NULL_HANDLE) continue;
+
+        info.presentationSupport.resize(info.queueFamilies.size(), VK_FALSE);
+        for (uint32_t family = 0; family < info.queueFamilies.size(); ++family)
+            vkGetPhysicalDeviceSurfaceSupportKHR(
+                    info.device, family, surface, &info.presentationSupport[family]);
+
+        count = 0;
+        vkGetPhysicalDeviceSurfaceFormatsKHR(info.device, surface, &count, nullptr);
+        info.surfaceFormats.resize(count);
+        if (count != 0)
+            vkGetPhysicalDeviceSurfaceFormatsKHR(
+                    info.device, surface, &count, info.surfaceFormats.data());
+
+        count = 0;
+        vkGetPhysicalDeviceSurfacePresentModesKHR(info.device, surface, &count, nullptr);
+        info.presentationModes.resize(count);
+        if (count != 0)
+            vkGetPhysicalDeviceSurfacePresentModesKHR(
+                    info.device, surface, &count, info.presentationModes.data());
+    }
+}
+
+const DeviceInfo&
+DeviceSelector::select(const std::function<bool(const DeviceInfo&)>& isSuitable) const {
+    const char *override = std::getenv(DEVICE_OVERRIDE_VARIABLE);
+    if (override != nullptr && *override != '\0') {
+        const DeviceInfo *info = findOverride(override);
+        if (info == nullptr)
+            throw std::runtime_error(std::string("Failed to find the GPU selected by ") +
+                                     DEVICE_OVERRIDE_VARIABLE + "=" + override + ".");
+        if (!isSuitable(*info))
+            throw std::runtime_error(std::string("Failed to use ") +
+                                     info->properties.deviceName + ": it is not suitable.");
+        return *info;
+    }
+
+    /* Ties go to the device enumerated first */
+    const DeviceInfo *best = nullptr;
+    uint64_t bestScore = 0;
+    for (const auto& info : devices) {
+        if (!isSuitable(info)) continue;
+
+        uint64_t infoScore = score(info);
+        if (best == nullptr || infoScore > bestScore) {
+            best = &info;
+            bestScore = infoScore;
+        }
+    }
+
+    if (best == nullptr)
+        throw std::runtime_error("Failed to find a suitable GPU.");
+
+    return *best;
+}
+
+uint64_t
+DeviceSelector::score(const DeviceInfo& info) {
+    /* The type outweighs everything else put together, so a discrete GPU always wins over an
+     * integrated one (whose "device-local" heap is often just system memory) */
+    uint64_t typeScore = 0;
+    switch (info.properties.deviceType) {
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:   typeScore = 4; break;
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: typeScore = 3; break;
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:    typeScore = 2; break;
+        case VK_PHYSICAL_DEVICE_TYPE_CPU:            typeScore = 1; break;
+        default:                                     typeScore = 0; break;
+    }
+    uint64_t result = typeScore * 10000;
+
+    /* Up to 3200 for memory, 100 per GiB */
+    result += std::min<uint64_t>(info.getDeviceLocalBytes() >> 30, 32) * 100;
+
+    /* Copies and compute can overlap with rendering on families of their own */
+    if (info.findQueueFamily(VK_QUEUE_TRANSFER_BIT, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))
+        result += 100;
+    if (info.findQueueFamily(VK_QUEUE_COMPUTE_BIT, VK_QUEUE_GRAPHICS_BIT))
+        result += 100;
+    /* A graphics family that presents as well avoids sharing swap chain images */
+    for (uint32_t family = 0; family < info.presentationSupport.size(); ++family)
+        if (info.presentationSupport[family] &&
+                (info.queueFamilies[family].queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+            result += 50;
+            break;
+        }
+
+    /* Larger limits as a tie breaker between otherwise similar devices */
+    result += info.properties.limits.maxImageDimension2D / 1024;
+
+    return result;
+}
+
+const DeviceInfo *
+DeviceSelector::findOverride(const char *value) const {
+    std::string text(value);
+
+    /* An index into the enumeration order */
+    if (std::all_of(text.begin(), text.end(), [](unsigned char c) { return std::isdigit(c); })) {
+        unsigned long index = std::strtoul(value, nullptr, 10);
+        return index < devices.size() ? &devices[index] : nullptr;
+    }
+
+    /* Otherwise part of the device name, in any case */
+    auto lower = [](std::string s) {
+        std::transform(s.begin(), s.end(), s.begin(),
+                [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return s;
+    };
+    text = lower(text);
+    for (const auto& info : devices)
+        if (lower(info.properties.deviceName).find(text) != std::string::npos) return &info;
+
+    return nullptr;
+}
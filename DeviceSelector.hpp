@@ -0,0 +1,61 @@
+#ifndef DEVICE_SELECTOR_H
+#define DEVICE_SELECTOR_H
+
+#include "vulkan/vulkan_core.h"
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <vector>
+
+/* What the application needs to know about a physical device, queried once up front */
+struct DeviceInfo {
+    VkPhysicalDevice device = VK_NULL_HANDLE;
+    uint32_t index = 0; /* Position in the instance's enumeration order */
+    VkPhysicalDeviceProperties properties {};
+    VkPhysicalDeviceFeatures features {};
+    VkPhysicalDeviceMemoryProperties memoryProperties {};
+    std::vector<VkQueueFamilyProperties> queueFamilies;
+    std::vector<VkExtensionProperties> extensions;
+    /* Surface support, left empty without a surface. Capabilities are not cached since the
+     * current extent changes with the window */
+    std::vector<VkBool32> presentationSupport; /* Per queue family */
+    std::vector<VkSurfaceFormatKHR> surfaceFormats;
+    std::vector<VkPresentModeKHR> presentationModes;
+
+    bool hasExtension(const char *name) const;
+    /* First queue family with all of the given flags and none of the excluded ones */
+    std::optional<uint32_t> findQueueFamily(VkQueueFlags flags, VkQueueFlags excluded = 0) const;
+    /* Size of the largest device-local heap */
+    VkDeviceSize getDeviceLocalBytes() const;
+};
+
+/* Ranks the physical devices of an instance and picks one for the application.
+ * Devices are scored by type first (discrete over integrated over virtual over CPU), then by
+ * device-local memory, queue topology (dedicated transfer and async compute families) and
+ * limits. The DEVICE_OVERRIDE_VARIABLE environment variable overrides the ranking with either
+ * an index into the enumeration order or part of a device name. */
+class DeviceSelector {
+    public:
+        /* Query every device once; pass VK_NULL_HANDLE as surface when not presenting */
+        DeviceSelector(VkInstance instance, VkSurfaceKHR surface);
+
+        const std::vector<DeviceInfo>& getDevices() const { return devices; }
+
+        /* The best scoring device that isSuitable accepts, or the one the environment asks
+         * for. Throws if there is none */
+        const DeviceInfo& select(const std::function<bool(const DeviceInfo&)>& isSuitable) const;
+
+        /* Higher is better */
+        static uint64_t score(const DeviceInfo& info);
+
+        static constexpr const char *DEVICE_OVERRIDE_VARIABLE = "HT_DEVICE";
+
+    private:
+        std::vector<DeviceInfo> devices;
+
+        /* The device the override value refers to, if any */
+        const DeviceInfo *findOverride(const char *value) const;
+};
+
+#endif
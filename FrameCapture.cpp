@@ -0,0 +1,241 @@
+#include "FrameCapture.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+FrameCapture::FrameCapture(std::string outputDir, std::string goldenDir, uint32_t tolerance)
+        : outputDir(std::move(outputDir)), goldenDir(std::move(goldenDir)),
+          tolerance(tolerance) {
+    if (!this->outputDir.empty()) {
+        std::error_code error;
+        std::filesystem::create_directories(this->outputDir, error);
+        if (error)
+            throw std::runtime_error("Failed to create capture directory " + this->outputDir +
+                                     ".");
+    }
+
+    writer = std::thread(&FrameCapture::writerLoop, this);
+}
+
+FrameCapture::~FrameCapture() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeUp.notify_one();
+    writer.join();
+}
+
+bool
+FrameCapture::submit(CapturedFrame frame) {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!goldenDir.empty())
+            dequeued.wait(lock, [this] { return queue.size() < MAX_QUEUED_FRAMES; });
+        else if (queue.size() >= MAX_QUEUED_FRAMES) {
+            ++droppedCount;
+            return false;
+        }
+        queue.push_back(std::move(frame));
+    }
+    wakeUp.notify_one();
+    return true;
+}
+
+void
+FrameCapture::finish() {
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this] { return queue.empty() && !busy; });
+}
+
+void
+FrameCapture::writeSummary(std::ostream& out) const {
+    out << "Captured " << getCapturedCount() << " frames (" << getDroppedCount()
+        << " dropped)";
+    if (!goldenDir.empty())
+        out << ", " << getMismatchCount() << " of " << getComparedCount()
+            << " differ from the golden images";
+    out << "\n";
+}
+
+std::string
+FrameCapture::getFileName(uint64_t frame) {
+    char name[32];
+    snprintf(name, sizeof(name), "frame_%06llu.ppm", static_cast<unsigned long long>(frame));
+    return name;
+}
+
+void
+FrameCapture::writePpm(const std::string& path, const CapturedFrame& frame) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+        throw std::runtime_error("Failed to open " + path + ".");
+
+    file << "P6\n" << frame.width << " " << frame.height << "\n255\n";
+
+    /* One row at a time, reordered to RGB without alpha */
+    std::vector<uint8_t> row(size_t(frame.width) * 3);
+    int red = frame.bgra ? 2 : 0;
+    int blue = frame.bgra ? 0 : 2;
+    for (uint32_t y = 0; y < frame.height; ++y) {
+        const uint8_t *source = frame.pixels.data() + size_t(y) * frame.width * 4;
+        for (uint32_t x = 0; x < frame.width; ++x) {
+            row[x * 3 + 0] = source[x * 4 + red];
+            row[x * 3 + 1] = source[x * 4 + 1];
+            row[x * 3 + 2] = source[x * 4 + blue];
+        }
+        file.write(reinterpret_cast<const char *>(row.data()), row.size());
+    }
+
+    if (!file)
+        throw std::runtime_error("Failed to write " + path + ".");
+}
+
+bool
+FrameCapture::readPpm(const std::string& path, CapturedFrame& frame) {
+    std::ifstream file(path, std::ios::binary);
+    return file.is_open() && readPpmHeader(file, frame.width, frame.height) &&
+           readPpmPixels(file, frame);
+}
+
+bool
+FrameCapture::readPpmHeader(std::istream& file, uint32_t& width, uint32_t& height) {
+    /* Header fields are separated by whitespace, and may be interleaved with comments */
+    auto readField = [&file](uint32_t& value) {
+        file >> std::ws;
+        while (file.peek() == '#') {
+            file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            file >> std::ws;
+        }
+        return static_cast<bool>(file >> value);
+    };
+
+    std::string magic;
+    uint32_t maxValue = 0;
+    file >> magic;
+    if (magic != "P6" || !readField(width) || !readField(height) ||
+            !readField(maxValue) || maxValue != 255)
+        return false;
+    file.get(); /* The single whitespace before the pixels */
+    return static_cast<bool>(file);
+}
+
+bool
+FrameCapture::readPpmPixels(std::istream& file, CapturedFrame& frame) {
+    std::vector<uint8_t> rgb(size_t(frame.width) * frame.height * 3);
+    if (!file.read(reinterpret_cast<char *>(rgb.data()), rgb.size())) return false;
+
+    frame.bgra = false;
+    frame.pixels.resize(size_t(frame.width) * frame.height * 4);
+    for (size_t i = 0; i < size_t(frame.width) * frame.height; ++i) {
+        frame.pixels[i * 4 + 0] = rgb[i * 3 + 0];
+        frame.pixels[i * 4 + 1] = rgb[i * 3 + 1];
+        frame.pixels[i * 4 + 2] = rgb[i * 3 + 2];
+        frame.pixels[i * 4 + 3] = 255;
+    }
+
+    return true;
+}
+
+void
+FrameCapture::process(const CapturedFrame& frame) {
+    std::string name = getFileName(frame.frame);
+
+    if (!outputDir.empty()) {
+        try {
+            writePpm(outputDir + "/" + name, frame);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+
+    if (!goldenDir.empty()) {
+        ++comparedCount;
+        bool matches = false;
+        try {
+            matches = compare(frame);
+        } catch (const std::exception& e) {
+            std::cerr << "Frame " << frame.frame << ": " << e.what() << std::endl;
+        }
+        if (!matches) ++mismatchCount;
+    }
+
+    ++capturedCount;
+}
+
+bool
+FrameCapture::compare(const CapturedFrame& frame) const {
+    std::string path = goldenDir + "/" + getFileName(frame.frame);
+
+    /* The size comes first, so a bad header can't have us allocate more than the frame */
+    CapturedFrame golden;
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open() || !readPpmHeader(file, golden.width, golden.height)) {
+        std::cerr << "Frame " << frame.frame << ": no golden image at " << path << std::endl;
+        return false;
+    }
+    if (golden.width != frame.width || golden.height != frame.height) {
+        std::cerr << "Frame " << frame.frame << ": " << frame.width << "x" << frame.height
+                  << ", but the golden image is " << golden.width << "x" << golden.height
+                  << std::endl;
+        return false;
+    }
+    if (!readPpmPixels(file, golden)) {
+        std::cerr << "Frame " << frame.frame << ": golden image " << path << " is truncated"
+                  << std::endl;
+        return false;
+    }
+
+    /* Alpha isn't stored in the golden images, so only color is compared */
+    int red = frame.bgra ? 2 : 0;
+    int blue = frame.bgra ? 0 : 2;
+    size_t pixelCount = size_t(frame.width) * frame.height;
+    size_t differingPixels = 0;
+    int largestDifference = 0;
+    for (size_t i = 0; i < pixelCount; ++i) {
+        const uint8_t *captured = &frame.pixels[i * 4];
+        const uint8_t *expected = &golden.pixels[i * 4];
+        int difference = std::max({ std::abs(captured[red] - expected[0]),
+                                    std::abs(captured[1] - expected[1]),
+                                    std::abs(captured[blue] - expected[2]) });
+        if (difference > static_cast<int>(tolerance)) {
+            ++differingPixels;
+            largestDifference = std::max(largestDifference, difference);
+        }
+    }
+
+    if (differingPixels != 0)
+        std::cerr << "Frame " << frame.frame << ": " << differingPixels << " of " << pixelCount
+                  << " pixels differ from the golden image, by up to " << largestDifference
+                  << std::endl;
+
+    return differingPixels == 0;
+}
+
+void
+FrameCapture::writerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        wakeUp.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (queue.empty()) return; /* Stopping, and nothing left to do */
+
+        CapturedFrame frame = std::move(queue.front());
+        queue.pop_front();
+        busy = true;
+        dequeued.notify_one();
+
+        /* Files are written without the lock, so the render loop can keep queueing */
+        lock.unlock();
+        process(frame);
+        lock.lock();
+
+        busy = false;
+        if (queue.empty()) finished.notify_all();
+    }
+}
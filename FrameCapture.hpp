@@ -0,0 +1,98 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* A frame read back from the GPU */
+struct CapturedFrame {
+    uint64_t frame = 0; /* Frame number it was drawn as */
+    uint32_t width = 0;
+    uint32_t height = 0;
+    bool bgra = false;           /* Channel order of the pixels, else RGBA */
+    std::vector<uint8_t> pixels; /* 4 bytes per pixel, rows tightly packed */
+};
+
+/* Saves and checks frames read back from the GPU on a thread of its own, so the render loop
+ * only pays for copying them out of the readback buffer.
+ *
+ * Frames are written as binary PPM files named after their frame number into the output
+ * directory, and compared with the file of the same name in the golden directory: a frame
+ * matches if no channel of any pixel differs by more than the tolerance. Frames handed over
+ * while MAX_QUEUED_FRAMES are still waiting are dropped rather than stalling the caller,
+ * unless they are compared: then the caller waits, as a dropped frame would go unchecked. */
+class FrameCapture {
+    public:
+        /* Either directory may be empty to skip writing or comparing */
+        FrameCapture(std::string outputDir, std::string goldenDir, uint32_t tolerance);
+        ~FrameCapture();
+
+        FrameCapture(const FrameCapture&) = delete;
+        FrameCapture& operator=(const FrameCapture&) = delete;
+
+        /* Queue a frame to be written and compared; false if it was dropped. Waits for room
+         * in the queue instead of dropping when comparing with golden images */
+        bool submit(CapturedFrame frame);
+        /* Wait until every queued frame has been processed */
+        void finish();
+        /* Count a frame that could not even be read back */
+        void drop() { ++droppedCount; }
+
+        uint64_t getCapturedCount() const { return capturedCount.load(); }
+        uint64_t getDroppedCount() const { return droppedCount.load(); }
+        uint64_t getComparedCount() const { return comparedCount.load(); }
+        /* Frames that differ from their golden image, or have none */
+        uint64_t getMismatchCount() const { return mismatchCount.load(); }
+        /* Print how many frames were captured, dropped and compared */
+        void writeSummary(std::ostream& out) const;
+
+        /* File name a frame is written as and looked up by */
+        static std::string getFileName(uint64_t frame);
+        /* Write a frame as binary PPM, dropping alpha */
+        static void writePpm(const std::string& path, const CapturedFrame& frame);
+        /* Read a binary PPM with 8-bit channels as RGBA, allocating as much as its header says;
+         * false if it can't be read */
+        static bool readPpm(const std::string& path, CapturedFrame& frame);
+
+        static const size_t MAX_QUEUED_FRAMES = 16;
+
+    private:
+        std::string outputDir;
+        std::string goldenDir;
+        uint32_t tolerance;
+
+        std::mutex mutex;
+        std::condition_variable wakeUp;   /* Frames queued, or stopping */
+        std::condition_variable finished; /* The queue ran empty */
+        std::condition_variable dequeued; /* The writer took a frame off the queue */
+        std::deque<CapturedFrame> queue;
+        bool busy = false;                /* The writer is processing a frame */
+        bool stopping = false;
+        std::thread writer;
+
+        std::atomic<uint64_t> capturedCount { 0 };
+        std::atomic<uint64_t> droppedCount { 0 };
+        std::atomic<uint64_t> comparedCount { 0 };
+        std::atomic<uint64_t> mismatchCount { 0 };
+
+        void process(const CapturedFrame& frame);
+        /* Compare a frame with its golden image, reporting differences on stderr */
+        bool compare(const CapturedFrame& frame) const;
+        /* Read the size from a PPM header, leaving the stream at the pixels; nothing is
+         * allocated, so the size can be checked before trusting it */
+        static bool readPpmHeader(std::istream& file, uint32_t& width, uint32_t& height);
+        /* Read as many pixels as frame's size says, as RGBA */
+        static bool readPpmPixels(std::istream& file, CapturedFrame& frame);
+        void writerLoop();
+};
+
+#endif
@@ -0,0 +1,105 @@
+#include "FramePacer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+
+static double millisecondsBetween(FramePacer::Clock::time_point start,
+                                  FramePacer::Clock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+FramePacer::FramePacer(double targetFps)
+        : targetFps(targetFps) {
+    if (!(targetFps > 0.0))
+        throw std::runtime_error("Failed to set up frame pacing: target rate must be positive.");
+
+    period = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(1.0 / targetFps));
+}
+
+double
+FramePacer::getPredictedFrameMs() const {
+    return frameMs + DEVIATION_MARGIN * frameDeviationMs;
+}
+
+double
+FramePacer::waitForNextFrame() {
+    Clock::time_point now = Clock::now();
+
+    /* Nothing to predict from yet; the first frame starts right away */
+    if (!started) {
+        started = true;
+        deadline = now + period;
+        frameStart = now;
+        lastWaitMs = 0.0;
+        return lastWaitMs;
+    }
+
+    /* A frame taking longer than a period is started at once, without waiting at all */
+    auto predicted = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double, std::milli>(getPredictedFrameMs()));
+    Clock::time_point wakeUp = deadline - std::min<Clock::duration>(predicted, period);
+    if (wakeUp > now) waitUntil(wakeUp);
+
+    frameStart = Clock::now();
+    lastWaitMs = millisecondsBetween(now, frameStart);
+    totalWaitMs += lastWaitMs;
+    return lastWaitMs;
+}
+
+void
+FramePacer::frameDone() {
+    Clock::time_point now = Clock::now();
+    double sampleMs = millisecondsBetween(frameStart, now);
+
+    /* Smooth the duration and its deviation the way TCP smooths round trip times, so a
+     * single slow frame widens the margin without dragging the prediction along */
+    if (frameCount == 0) {
+        frameMs = sampleMs;
+        frameDeviationMs = sampleMs / 2.0;
+    } else {
+        frameDeviationMs += DEVIATION_GAIN * (std::abs(sampleMs - frameMs) - frameDeviationMs);
+        frameMs += DURATION_GAIN * (sampleMs - frameMs);
+    }
+    ++frameCount;
+
+    /* Keep the cadence while deadlines are met; once one is missed, the frames behind it
+     * would only be presented in a burst, so the schedule starts over from now */
+    if (now > deadline) {
+        ++missedCount;
+        deadline = now + period;
+    } else
+        deadline += period;
+}
+
+void
+FramePacer::waitUntil(Clock::time_point wakeUp) {
+    /* Sleep until the spin is due, noting how far the sleep overshot */
+    auto spin = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double, std::milli>(spinMs));
+    Clock::time_point sleepUntil = wakeUp - spin;
+    if (sleepUntil > Clock::now()) {
+        std::this_thread::sleep_until(sleepUntil);
+        double overshootMs = millisecondsBetween(sleepUntil, Clock::now());
+
+        /* Grow at once when a sleep overshoots the spin, shrink back slowly otherwise */
+        spinMs = overshootMs > spinMs ? overshootMs : spinMs + 0.05 * (overshootMs - spinMs);
+        spinMs = std::min(std::max(spinMs, MIN_SPIN_MS), MAX_SPIN_MS);
+    }
+
+    /* Then spin the rest of the way, yielding the core to anything else that wants it */
+    Clock::time_point spinStart = Clock::now();
+    while (Clock::now() < wakeUp) std::this_thread::yield();
+    totalSpinMs += std::max(millisecondsBetween(spinStart, Clock::now()), 0.0);
+}
+
+void
+FramePacer::writeSummary(std::ostream& out) const {
+    double frames = static_cast<double>(std::max<uint64_t>(frameCount, 1));
+    out << "Paced to " << targetFps << " fps: " << missedCount << " of " << frameCount
+        << " frames missed their deadline, waited " << totalWaitMs / frames
+        << " ms per frame (" << totalSpinMs / frames << " ms spinning), predicted frame "
+        << getPredictedFrameMs() << " ms\n";
+}
@@ -0,0 +1,71 @@
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+/* Holds the render loop back to a target frame rate, so frames that would only be thrown away
+ * (or queued up behind the display) are never drawn and the loop's thread mostly sleeps.
+ *
+ * Every frame has a deadline, one period after the previous one, by which it should have been
+ * presented. The loop is woken up as late as the pacer dares: the predicted frame duration
+ * (from waking up until present returned, smoothed over recent frames, plus a margin for its
+ * variation) ahead of the deadline, so input polled right after waking is as fresh as it can
+ * be once the frame is shown. Waiting sleeps, then spins for the last stretch, which is kept
+ * as long as sleeps have lately been seen to overshoot. A frame that misses its deadline
+ * starts the schedule over instead of having later frames hurry to catch up.
+ *
+ * Only to be used from the render loop's thread. */
+class FramePacer {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        explicit FramePacer(double targetFps);
+
+        /* Wait until the next frame should start; returns the time waited, in milliseconds */
+        double waitForNextFrame();
+        /* Report that the frame started by the last wait has been presented */
+        void frameDone();
+
+        double getTargetFps() const { return targetFps; }
+        double getLastWaitMs() const { return lastWaitMs; }
+        /* Predicted time from waking up until the frame is presented */
+        double getPredictedFrameMs() const;
+        uint64_t getFrameCount() const { return frameCount; }
+        /* Frames presented after their deadline */
+        uint64_t getMissedCount() const { return missedCount; }
+        /* Print the frame count, missed deadlines and time spent waiting */
+        void writeSummary(std::ostream& out) const;
+
+        /* Weights of a new sample in the smoothed frame duration and its deviation */
+        static constexpr double DURATION_GAIN = 0.125;
+        static constexpr double DEVIATION_GAIN = 0.25;
+        /* Deviations added to the smoothed duration when predicting a frame */
+        static constexpr double DEVIATION_MARGIN = 4.0;
+        /* Bounds of the stretch spun instead of slept, in milliseconds */
+        static constexpr double MIN_SPIN_MS = 0.05;
+        static constexpr double MAX_SPIN_MS = 2.0;
+
+    private:
+        double targetFps;
+        Clock::duration period;
+        Clock::time_point deadline;   /* When the current frame should be presented by */
+        Clock::time_point frameStart; /* When the loop was woken up for the current frame */
+        bool started = false;
+
+        double frameMs = 0.0;          /* Smoothed frame duration */
+        double frameDeviationMs = 0.0; /* Smoothed deviation of frame durations from it */
+        double spinMs = MIN_SPIN_MS;   /* Lately observed sleep overshoot */
+
+        double lastWaitMs = 0.0;
+        uint64_t frameCount = 0;
+        uint64_t missedCount = 0;
+        double totalWaitMs = 0.0;
+        double totalSpinMs = 0.0;
+
+        /* Sleep, then spin, until a point in time */
+        void waitUntil(Clock::time_point wakeUp);
+};
+
+#endif
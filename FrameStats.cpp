@@ -0,0 +1,168 @@
+#include "FrameStats.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <string>
+
+FrameStats::FrameStats(size_t capacity)
+    : capacity(capacity), slots(new Slot[capacity]) {}
+
+void
+FrameStats::push(const FrameTiming& timing) {
+    uint64_t index = head.load(std::memory_order_relaxed);
+    Slot& slot = slots[index % capacity];
+
+    /* Mark the slot as being written before touching its contents */
+    slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.timing = timing;
+
+    /* Publish the contents, then the new head */
+    slot.sequence.store(2 * (index + 1), std::memory_order_release);
+    head.store(index + 1, std::memory_order_release);
+}
+
+std::vector<FrameTiming>
+FrameStats::snapshot() const {
+    uint64_t end = head.load(std::memory_order_acquire);
+    uint64_t begin = end > capacity ? end - capacity : 0;
+
+    std::vector<FrameTiming> frames;
+    frames.reserve(end - begin);
+
+    for (uint64_t index = begin; index < end; ++index) {
+        const Slot& slot = slots[index % capacity];
+
+        uint64_t before = slot.sequence.load(std::memory_order_acquire);
+        FrameTiming timing = slot.timing;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t after = slot.sequence.load(std::memory_order_relaxed);
+
+        /* Skip entries that were overwritten while we were reading them */
+        if (before == 2 * (index + 1) && before == after)
+            frames.push_back(timing);
+    }
+
+    return frames;
+}
+
+uint64_t
+FrameStats::count() const {
+    return head.load(std::memory_order_acquire);
+}
+
+TimingSummary
+FrameStats::summarize(double FrameTiming::*column) const {
+    std::vector<double> samples;
+    for (const auto& timing : snapshot())
+        samples.push_back(timing.*column);
+
+    return summarize(std::move(samples));
+}
+
+TimingSummary
+FrameStats::summarize(std::vector<double> samples) {
+    samples.erase(std::remove_if(samples.begin(), samples.end(),
+                                 [](double sample) { return sample < 0.0; }),
+                  samples.end());
+
+    TimingSummary summary {};
+    if (samples.empty()) return summary;
+
+    std::sort(samples.begin(), samples.end());
+
+    /* Nearest-rank percentile */
+    auto percentile = [&samples](double p) {
+        size_t rank = static_cast<size_t>(std::ceil(p * samples.size()));
+        return samples[std::min(samples.size(), std::max<size_t>(rank, 1)) - 1];
+    };
+
+    double total = 0.0;
+    for (double sample : samples) total += sample;
+
+    summary.p50 = percentile(0.50);
+    summary.p95 = percentile(0.95);
+    summary.p99 = percentile(0.99);
+    summary.mean = total / samples.size();
+    summary.max = samples.back();
+
+    return summary;
+}
+
+void
+FrameStats::writeCsv(std::ostream& out) const {
+    out << "frame,fence_wait_ms,acquire_ms,record_ms,submit_ms,present_ms,cpu_frame_ms,gpu_ms,"
+           "pace_ms\n";
+    for (const auto& timing : snapshot())
+        out << timing.frame << ','
+            << timing.fenceWaitMs << ','
+            << timing.acquireMs << ','
+            << timing.recordMs << ','
+            << timing.submitMs << ','
+            << timing.presentMs << ','
+            << timing.cpuFrameMs << ','
+            << timing.gpuMs << ','
+            << timing.paceMs << '\n';
+}
+
+void
+FrameStats::writeSummary(std::ostream& out) const {
+    const struct {
+        const char *name;
+        double FrameTiming::*column;
+    } columns[] = {
+        { "fence wait", &FrameTiming::fenceWaitMs },
+        { "acquire",    &FrameTiming::acquireMs },
+        { "record",     &FrameTiming::recordMs },
+        { "submit",     &FrameTiming::submitMs },
+        { "present",    &FrameTiming::presentMs },
+        { "cpu frame",  &FrameTiming::cpuFrameMs },
+        { "gpu",        &FrameTiming::gpuMs },
+        { "pace",       &FrameTiming::paceMs },
+    };
+
+    std::vector<FrameTiming> frames = snapshot();
+    out << "Frame timings over the last " << frames.size() << " frames (ms):\n";
+    out << std::fixed << std::setprecision(3);
+    out << std::setw(12) << "" << std::setw(10) << "p50" << std::setw(10) << "p95"
+        << std::setw(10) << "p99" << std::setw(10) << "mean" << std::setw(10) << "max" << '\n';
+
+    for (const auto& column : columns) {
+        TimingSummary summary = summarize(column.column);
+        out << std::setw(12) << column.name
+            << std::setw(10) << summary.p50
+            << std::setw(10) << summary.p95
+            << std::setw(10) << summary.p99
+            << std::setw(10) << summary.mean
+            << std::setw(10) << summary.max << '\n';
+    }
+
+    /* Bucket CPU frame times by powers of two so stalls stand out */
+    const double bucketLimits[] = { 0.5, 1.0, 2.0, 4.0, 8.0, 16.0, 33.0, 66.0 };
+    const size_t bucketCount = sizeof(bucketLimits) / sizeof(bucketLimits[0]) + 1;
+    size_t buckets[bucketCount] = {};
+
+    for (const auto& timing : frames) {
+        size_t bucket = 0;
+        while (bucket < bucketCount - 1 && timing.cpuFrameMs >= bucketLimits[bucket]) ++bucket;
+        ++buckets[bucket];
+    }
+
+    size_t largest = *std::max_element(buckets, buckets + bucketCount);
+    const size_t barWidth = 40;
+
+    out << "CPU frame time histogram:\n";
+    for (size_t bucket = 0; bucket < bucketCount; ++bucket) {
+        std::string label = bucket < bucketCount - 1
+            ? "< " + std::to_string(bucketLimits[bucket]).substr(0, 4)
+            : ">= " + std::to_string(bucketLimits[bucketCount - 2]).substr(0, 4);
+        size_t bar = largest == 0 ? 0 : buckets[bucket] * barWidth / largest;
+
+        out << std::setw(10) << label << " ms |" << std::string(bar, '#')
+            << ' ' << buckets[bucket] << '\n';
+    }
+
+    out << std::defaultfloat;
+}
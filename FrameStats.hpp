@@ -0,0 +1,69 @@
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+/* CPU and GPU timings recorded for a single frame, in milliseconds */
+struct FrameTiming {
+    uint64_t frame;     /* The frame number */
+    double paceMs;      /* Time the frame pacer held the frame back before it started */
+    double fenceWaitMs; /* Time blocked on earlier frames (fences or timeline) before starting */
+    double acquireMs;   /* Time spent acquiring a swap chain image */
+    double recordMs;    /* Time spent recording command buffers (0 if pre-recorded) */
+    double submitMs;    /* Time spent in vkQueueSubmit */
+    double presentMs;   /* Time spent in vkQueuePresentKHR */
+    double cpuFrameMs;  /* Total CPU time spent drawing the frame */
+    double gpuMs;       /* GPU time spent in the render pass (negative if unavailable) */
+};
+
+/* Summary of one timing column */
+struct TimingSummary {
+    double p50;
+    double p95;
+    double p99;
+    double mean;
+    double max;
+};
+
+/* Fixed-size ring of the most recent frame timings.
+ * One thread (the render loop) pushes; any thread may read without locking. */
+class FrameStats {
+    public:
+        explicit FrameStats(size_t capacity = 8192);
+
+        /* Record a frame; wait-free, only to be called from one thread */
+        void push(const FrameTiming& timing);
+        /* Copy out the frames currently held, oldest first */
+        std::vector<FrameTiming> snapshot() const;
+        /* Number of frames pushed so far (including ones since overwritten) */
+        uint64_t count() const;
+
+        /* Summarize one column over the frames currently held; negative samples are skipped */
+        TimingSummary summarize(double FrameTiming::*column) const;
+
+        /* Dump every held frame as CSV, one row per frame */
+        void writeCsv(std::ostream& out) const;
+        /* Print percentiles per column and a histogram of CPU frame times */
+        void writeSummary(std::ostream& out) const;
+
+        /* Summarize a set of samples */
+        static TimingSummary summarize(std::vector<double> samples);
+
+    private:
+        /* A ring entry; sequence is odd while being written and 2 * (index + 1) once complete */
+        struct Slot {
+            std::atomic<uint64_t> sequence { 0 };
+            FrameTiming timing;
+        };
+
+        size_t capacity;
+        std::unique_ptr<Slot[]> slots;
+        std::atomic<uint64_t> head { 0 }; /* Index of the next frame to be pushed */
+};
+
+#endif
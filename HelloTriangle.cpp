@@ -2,10 +2,19 @@
 #include "vulkan/vulkan_core.h"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
 #include <cstdint>
+#include <cstdio>
 #include <cstring>
+#include <deque>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <mutex>
 #include <set>
 #include <stdexcept>
 #include <string>
@@ -14,69 +23,357 @@
 #define GLFW_INCLUDE_VULKAN 
 #include <GLFW/glfw3.h>
 
-HelloTriangleApplication::HelloTriangleApplication() {
-    /* Initialize window */
-    glfwInit();
-    
-    /* Disable OpenGL, we aren't using it */
-    glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-    glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-
-    window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
-
-    /* Initialize Vulkan stuff */
-    createInstance();
-    createSurface();
-    pickPhysicalDevice();
-    createLogicalDevice();
-    createSwapChain();
-    createImageViews();
-    createRenderPass();
-    createGraphicsPipeline();
-    createFramebuffers();
-    createCommandPool();
-    createCommandBuffers();
-    createSynchronizationObjs();
+/* Milliseconds elapsed on the steady clock since a given point */
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+HelloTriangleApplication::HelloTriangleApplication(const AppConfig& config)
+        : config(config), presentProfile(config.presentProfile) {
+    framesInFlight = getPresentPolicy(presentProfile).framesInFlight;
+    jobSystem = std::make_unique<JobSystem>(config.recordThreads);
+    if (config.hostAllocator) {
+        hostAllocator = std::make_unique<HostAllocator>(config.hostMemoryLimit);
+        instanceCallbacks = hostAllocator->getCallbacks(HostAllocationCategory::Instance);
+        deviceCallbacks = hostAllocator->getCallbacks(HostAllocationCategory::Device);
+        pipelineCallbacks = hostAllocator->getCallbacks(HostAllocationCategory::Pipeline);
+        commandPoolCallbacks = hostAllocator->getCallbacks(HostAllocationCategory::CommandPool);
+    }
+    /* Before the instance, which reports its own creation through the sink */
+    if (enableValidationLayers) debugSink = std::make_unique<DebugSink>();
+    if (config.targetFps > 0.0) framePacer = std::make_unique<FramePacer>(config.targetFps);
+
+    /* Headless mode never touches the windowing system */
+    if (!config.headless) {
+        /* Initialize window */
+        glfwInit();
+
+        /* Disable OpenGL, we aren't using it */
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+        glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
+
+        window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
+        glfwSetWindowUserPointer(window, this);
+        glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+        glfwSetKeyCallback(window, keyCallback);
+    }
 
-    /* Initialize debugging */
-    setupDebugMessenger();
+    /* Initialize Vulkan stuff as a graph of steps, running those that don't depend on each
+     * other in parallel and timing each step */
+    const char *imagesStep = config.headless ? "createOffscreenImages" : "createSwapChain";
+    std::vector<InitStep> steps = {
+        /* Shaders are read from disk while the device is being set up */
+        { "loadShaderCode", &HelloTriangleApplication::loadShaderCode, {} },
+        { "createInstance", &HelloTriangleApplication::createInstance, {}, true },
+        { "setupDebugMessenger", &HelloTriangleApplication::setupDebugMessenger,
+            { "createInstance" } },
+        { "pickPhysicalDevice", &HelloTriangleApplication::pickPhysicalDevice,
+            { config.headless ? "createInstance" : "createSurface" }, true },
+        { "createLogicalDevice", &HelloTriangleApplication::createLogicalDevice,
+            { "pickPhysicalDevice" }, true },
+        /* The window size may only be queried from the main thread */
+        { imagesStep, config.headless ? &HelloTriangleApplication::createOffscreenImages
+                                      : &HelloTriangleApplication::createSwapChain,
+            { "createLogicalDevice" }, !config.headless },
+        { "createImageViews", &HelloTriangleApplication::createImageViews, { imagesStep } },
+        { "createRenderPass", &HelloTriangleApplication::createRenderPass, { imagesStep } },
+        { "createPipelineCache", &HelloTriangleApplication::createPipelineCache,
+            { "createLogicalDevice" } },
+        { "createGraphicsPipeline", &HelloTriangleApplication::createGraphicsPipeline,
+            { "createRenderPass", "createPipelineCache", "loadShaderCode" } },
+        { "createColorResources", &HelloTriangleApplication::createColorResources,
+            { imagesStep } },
+        { "createFramebuffers", &HelloTriangleApplication::createFramebuffers,
+            { "createImageViews", "createColorResources", "createRenderPass" } },
+        { "createCommandPool", &HelloTriangleApplication::createCommandPool,
+            { "createLogicalDevice" } },
+        { "createUploadResources", &HelloTriangleApplication::createUploadResources,
+            { "createLogicalDevice" } },
+        { "createGeometryBuffers", &HelloTriangleApplication::createGeometryBuffers,
+            { "createCommandPool", "createUploadResources" } },
+        { "createTimestampQueryPool", &HelloTriangleApplication::createTimestampQueryPool,
+            { imagesStep } },
+        { "createSynchronizationObjs", &HelloTriangleApplication::createSynchronizationObjs,
+            { imagesStep } },
+    };
+    if (!config.headless)
+        steps.push_back({ "createSurface", &HelloTriangleApplication::createSurface,
+                          { "createInstance" }, true });
+
+    std::vector<const char *> commandBufferDependencies = { "createFramebuffers",
+            "createGraphicsPipeline", "createCommandPool", "createGeometryBuffers",
+            "createTimestampQueryPool" };
+    if (config.animateInstances) {
+        steps.push_back({ "createComputePipeline", &HelloTriangleApplication::createComputePipeline,
+                          { "createPipelineCache", "loadShaderCode" } });
+        steps.push_back({ "createAnimatedInstanceBuffer",
+                          &HelloTriangleApplication::createAnimatedInstanceBuffer,
+                          { "createComputePipeline", imagesStep } });
+        commandBufferDependencies.push_back("createAnimatedInstanceBuffer");
+    }
+    if (config.gpuDriven) {
+        steps.push_back({ "createCullPipeline", &HelloTriangleApplication::createCullPipeline,
+                          { "createPipelineCache", "loadShaderCode" } });
+        /* The culling descriptors point at whichever instance buffer the draws read */
+        std::vector<const char *> indirectDependencies = { "createCullPipeline", imagesStep,
+                "createGeometryBuffers" };
+        if (config.animateInstances)
+            indirectDependencies.push_back("createAnimatedInstanceBuffer");
+        steps.push_back({ "createIndirectBuffers", &HelloTriangleApplication::createIndirectBuffers,
+                          indirectDependencies });
+        commandBufferDependencies.push_back("createIndirectBuffers");
+        if (config.rerecordCommandBuffers)
+            steps.push_back({ "createFrameArenas", &HelloTriangleApplication::createFrameArenas,
+                              { "createCullPipeline" } });
+    }
+    steps.push_back({ "createCommandBuffers", &HelloTriangleApplication::createCommandBuffers,
+                      commandBufferDependencies });
+    if (config.capturesFrames())
+        steps.push_back({ "createCaptureResources",
+                          &HelloTriangleApplication::createCaptureResources, { imagesStep } });
+    if (config.rerecordCommandBuffers)
+        steps.push_back({ "createFrameCommandPools",
+                          &HelloTriangleApplication::createFrameCommandPools,
+                          { "createLogicalDevice" } });
+
+    runInitSteps(steps);
 }
 
 HelloTriangleApplication::~HelloTriangleApplication() {
+    /* Uploads may still be in flight if no frame was ever drawn */
+    vkDeviceWaitIdle(logicalDevice);
+
     /* Destroy instance components */
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
-        vkDestroySemaphore(logicalDevice, renderFinishedSemaphores[i], nullptr);
-        vkDestroySemaphore(logicalDevice, imageAvailableSemaphores[i], nullptr);
-        vkDestroyFence(logicalDevice, inFlightFences[i], nullptr);
+    releaseRetiredSwapChains(true);
+    releaseUploadBatches(true);
+    stagingRing.reset();
+    vkDestroyCommandPool(logicalDevice, transferCommandPool, commandPoolCallbacks);
+    if (config.animateInstances) {
+        vkDestroyBuffer(logicalDevice, animatedInstanceBuffer, deviceCallbacks);
+        deviceAllocator->free(animatedInstanceMemory);
+        for (auto semaphore : computeFinishedSemaphores)
+            vkDestroySemaphore(logicalDevice, semaphore, deviceCallbacks);
+        vkDestroyCommandPool(logicalDevice, computeCommandPool, commandPoolCallbacks);
+        vkDestroyDescriptorPool(logicalDevice, computeDescriptorPool, deviceCallbacks);
+        vkDestroyPipeline(logicalDevice, computePipeline, pipelineCallbacks);
+        vkDestroyPipelineLayout(logicalDevice, computePipelineLayout, pipelineCallbacks);
+        vkDestroyDescriptorSetLayout(logicalDevice, computeDescriptorSetLayout, deviceCallbacks);
     }
-    vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
+    if (useGpuCulling) {
+        vkDestroyBuffer(logicalDevice, indirectBuffer, deviceCallbacks);
+        deviceAllocator->free(indirectMemory);
+        vkDestroyBuffer(logicalDevice, drawCountBuffer, deviceCallbacks);
+        deviceAllocator->free(drawCountMemory);
+        /* The arenas themselves go with the allocator, the sets with their pool */
+        for (auto& frame : frameArenas)
+            vkDestroyBuffer(logicalDevice, frame.buffer, deviceCallbacks);
+        vkDestroyDescriptorPool(logicalDevice, cullDescriptorPool, deviceCallbacks);
+        vkDestroyPipeline(logicalDevice, cullPipeline, pipelineCallbacks);
+        vkDestroyPipelineLayout(logicalDevice, cullPipelineLayout, pipelineCallbacks);
+        vkDestroyDescriptorSetLayout(logicalDevice, cullDescriptorSetLayout, deviceCallbacks);
+    }
+    for (size_t i = 0; i < imageAvailableSemaphores.size(); ++i) {
+        vkDestroySemaphore(logicalDevice, renderFinishedSemaphores[i], deviceCallbacks);
+        vkDestroySemaphore(logicalDevice, imageAvailableSemaphores[i], deviceCallbacks);
+    }
+    for (auto fence : inFlightFences)
+        vkDestroyFence(logicalDevice, fence, deviceCallbacks);
+    if (frameTimeline != VK_NULL_HANDLE)
+        vkDestroySemaphore(logicalDevice, frameTimeline, deviceCallbacks);
+    if (timestampQueryPool != VK_NULL_HANDLE)
+        vkDestroyQueryPool(logicalDevice, timestampQueryPool, deviceCallbacks);
+    vkDestroyBuffer(logicalDevice, instanceBuffer, deviceCallbacks);
+    deviceAllocator->free(instanceBufferMemory);
+    vkDestroyBuffer(logicalDevice, indexBuffer, deviceCallbacks);
+    deviceAllocator->free(indexBufferMemory);
+    vkDestroyBuffer(logicalDevice, vertexBuffer, deviceCallbacks);
+    deviceAllocator->free(vertexBufferMemory);
+    vkDestroyCommandPool(logicalDevice, commandPool, commandPoolCallbacks);
+    for (auto pool : recordCommandPools)
+        vkDestroyCommandPool(logicalDevice, pool, commandPoolCallbacks);
+    for (auto pool : frameCommandPools)
+        vkDestroyCommandPool(logicalDevice, pool, commandPoolCallbacks);
+    for (auto pool : frameSecondaryCommandPools)
+        vkDestroyCommandPool(logicalDevice, pool, commandPoolCallbacks);
+    for (auto& slot : captureSlots)
+        if (slot.buffer != VK_NULL_HANDLE) {
+            vkDestroyBuffer(logicalDevice, slot.buffer, deviceCallbacks);
+            deviceAllocator->free(slot.memory);
+        }
+    if (captureCommandPool != VK_NULL_HANDLE)
+        vkDestroyCommandPool(logicalDevice, captureCommandPool, commandPoolCallbacks);
     for (auto framebuffer : swapChainFramebuffers)
-        vkDestroyFramebuffer(logicalDevice, framebuffer, nullptr);
-    vkDestroyPipeline(logicalDevice, graphicsPipeline, nullptr);
-    vkDestroyPipelineLayout(logicalDevice, pipelineLayout, nullptr);
-    vkDestroyRenderPass(logicalDevice, renderPass, nullptr);
+        vkDestroyFramebuffer(logicalDevice, framebuffer, deviceCallbacks);
+    if (colorImage != VK_NULL_HANDLE) {
+        vkDestroyImageView(logicalDevice, colorImageView, deviceCallbacks);
+        vkDestroyImage(logicalDevice, colorImage, deviceCallbacks);
+        deviceAllocator->free(colorImageMemory);
+    }
+    pipelineRegistry.reset();
+    vkDestroyShaderModule(logicalDevice, vertShaderModule, pipelineCallbacks);
+    vkDestroyShaderModule(logicalDevice, fragShaderModule, pipelineCallbacks);
+    savePipelineCache();
+    vkDestroyPipelineCache(logicalDevice, pipelineCache, pipelineCallbacks);
+    vkDestroyPipelineLayout(logicalDevice, pipelineLayout, pipelineCallbacks);
+    vkDestroyRenderPass(logicalDevice, renderPass, deviceCallbacks);
     for (auto& imageView : swapChainImageViews)
-        vkDestroyImageView(logicalDevice, imageView, nullptr);
-    vkDestroySwapchainKHR(logicalDevice, swapChain, nullptr);
-    vkDestroyDevice(logicalDevice, nullptr);
-    vkDestroySurfaceKHR(instance, surface, nullptr);
-    if (enableValidationLayers) DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
+        vkDestroyImageView(logicalDevice, imageView, deviceCallbacks);
+    if (config.headless) {
+        /* Offscreen images are owned by us, unlike swap chain images */
+        for (size_t i = 0; i < swapChainImages.size(); ++i) {
+            vkDestroyImage(logicalDevice, swapChainImages[i], deviceCallbacks);
+            deviceAllocator->free(offscreenImageMemory[i]);
+        }
+    } else
+        vkDestroySwapchainKHR(logicalDevice, swapChain, deviceCallbacks);
+    deviceAllocator.reset();
+    vkDestroyDevice(logicalDevice, deviceCallbacks);
+    if (!config.headless) vkDestroySurfaceKHR(instance, surface, instanceCallbacks);
+    if (enableValidationLayers)
+        DestroyDebugUtilsMessengerEXT(instance, debugMessenger, instanceCallbacks);
 
     /* Destroy window and instance */
-    vkDestroyInstance(instance, nullptr);
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    vkDestroyInstance(instance, instanceCallbacks);
+    /* Last, once nothing can report to it any more */
+    debugSink.reset();
+    hostAllocator.reset();
+    if (!config.headless) {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
+}
+
+void
+HelloTriangleApplication::runInitStep(const char *name, void (HelloTriangleApplication::*step)()) {
+    auto start = std::chrono::steady_clock::now();
+    (this->*step)();
+    double milliseconds = millisecondsSince(start);
+
+    std::lock_guard<std::mutex> lock(initTimingsMutex);
+    initTimings.emplace_back(name, milliseconds);
+}
+
+void
+HelloTriangleApplication::runInitSteps(const std::vector<InitStep>& steps) {
+    /* Count each step's unfinished dependencies, and note who waits on whom */
+    std::vector<std::atomic<size_t>> remaining(steps.size());
+    std::vector<std::vector<size_t>> dependents(steps.size());
+    for (size_t i = 0; i < steps.size(); ++i)
+        for (const char *dependency : steps[i].dependencies) {
+            auto it = std::find_if(steps.begin(), steps.end(), [&](const InitStep& step) {
+                return strcmp(step.name, dependency) == 0;
+            });
+            if (it == steps.end())
+                throw std::runtime_error("Failed to find init step dependency.");
+            dependents[it - steps.begin()].push_back(i);
+            remaining[i].fetch_add(1, std::memory_order_relaxed);
+        }
+
+    JobCounter counter;
+    std::mutex mainMutex;
+    std::deque<size_t> mainReady; /* Steps ready to run that must run on this thread */
+    std::atomic<size_t> mainReadyCount { 0 }; /* Its size, for waking up without the lock */
+    std::atomic<size_t> finished { 0 };
+
+    /* Run a step, then schedule whichever of its dependents it was the last one holding up */
+    std::function<void(size_t)> schedule;
+    auto run = [&](size_t index) {
+        runInitStep(steps[index].name, steps[index].function);
+        finished.fetch_add(1, std::memory_order_relaxed);
+        for (size_t dependent : dependents[index])
+            if (remaining[dependent].fetch_sub(1, std::memory_order_acq_rel) == 1)
+                schedule(dependent);
+    };
+    schedule = [&](size_t index) {
+        if (steps[index].mainThread) {
+            {
+                std::lock_guard<std::mutex> lock(mainMutex);
+                mainReady.push_back(index);
+            }
+            /* This thread may be waiting on worker jobs; it shouldn't wait for all of them */
+            mainReadyCount.fetch_add(1, std::memory_order_release);
+            jobSystem->notifyWaiters();
+        } else
+            jobSystem->submit(counter, [&run, index](size_t) { run(index); });
+    };
+
+    for (size_t i = 0; i < steps.size(); ++i)
+        if (remaining[i].load(std::memory_order_relaxed) == 0) schedule(i);
+
+    /* Run main thread steps as they become ready, and help with the rest in between. A failed
+     * step leaves its dependents unscheduled; jobs already running are let finish first */
+    while (true) {
+        std::optional<size_t> next;
+        {
+            std::lock_guard<std::mutex> lock(mainMutex);
+            if (!mainReady.empty()) {
+                next = mainReady.front();
+                mainReady.pop_front();
+                mainReadyCount.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+
+        if (next.has_value()) {
+            try {
+                run(next.value());
+            } catch (...) {
+                try { jobSystem->wait(counter); } catch (...) {}
+                throw;
+            }
+            continue;
+        }
+
+        /* Until a main thread step becomes ready, or there's nothing left to wait for */
+        if (!jobSystem->waitUntil(counter, [&mainReadyCount] {
+                return mainReadyCount.load(std::memory_order_acquire) > 0;
+            }))
+            continue;
+
+        std::lock_guard<std::mutex> lock(mainMutex);
+        if (mainReady.empty()) break;
+    }
+
+    if (finished.load(std::memory_order_relaxed) != steps.size())
+        throw std::runtime_error("Failed to run every init step: dependency cycle.");
 }
 
 void
 HelloTriangleApplication::run() {
-    /* Keep the window updated */
-    while (!glfwWindowShouldClose(window)) {
-        glfwPollEvents();
+    /* Keep the window updated until it closes or the requested number of frames is drawn */
+    while (config.frameCount == 0 || frameNumber < config.frameCount) {
+        /* Sleep off the time to spare before polling, so the frame sees the latest input */
+        if (framePacer) framePacer->waitForNextFrame();
+        if (!config.headless) {
+            if (glfwWindowShouldClose(window)) break;
+            glfwPollEvents();
+        }
         drawFrame();
+        if (framePacer) framePacer->frameDone();
     }
 
     vkDeviceWaitIdle(logicalDevice); /* Ensure asynchronous operations are completed before exit */
+
+    /* Everything has finished, so the last frames' GPU timestamps are ready */
+    for (uint32_t i = 0; i < swapChainImages.size(); ++i)
+        collectFrameTiming(i);
+    reportFrameStats();
+
+    /* As are the last captures */
+    if (frameCapture) {
+        collectCaptures(true);
+        frameCapture->finish();
+        frameCapture->writeSummary(std::cout);
+        if (frameCapture->getMismatchCount() != 0)
+            throw std::runtime_error("Failed golden image comparison: " +
+                    std::to_string(frameCapture->getMismatchCount()) + " of " +
+                    std::to_string(frameCapture->getComparedCount()) + " frames differ.");
+        /* A frame that was never compared can't be said to match */
+        if (!config.goldenDir.empty() && frameCapture->getDroppedCount() != 0)
+            throw std::runtime_error("Failed golden image comparison: " +
+                    std::to_string(frameCapture->getDroppedCount()) +
+                    " frames were dropped instead of compared.");
+    }
 }
 
 bool
@@ -108,10 +405,15 @@ HelloTriangleApplication::checkValidationLayerSupport() {
 
 std::vector<const char *>
 HelloTriangleApplication::getRequiredExtensions() {
-    uint32_t glfwExtensionCount = 0;
-    const char **glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    std::vector<const char *> extensions;
+
+    /* Surface extensions are only needed when presenting to a window */
+    if (!config.headless) {
+        uint32_t glfwExtensionCount = 0;
+        const char **glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+    }
 
-    std::vector<const char *> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
     /* Add debug utils extension if requested */
     if (enableValidationLayers) extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
 
@@ -130,7 +432,14 @@ HelloTriangleApplication::createInstance() {
     appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
     appInfo.pEngineName = "No Engine";
     appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-    appInfo.apiVersion = VK_API_VERSION_1_0;
+
+    /* Ask for the newest version we make use of; 1.0 loaders can't even report theirs */
+    instanceApiVersion = VK_API_VERSION_1_0;
+    auto enumerateInstanceVersion = (PFN_vkEnumerateInstanceVersion)
+                    vkGetInstanceProcAddr(nullptr, "vkEnumerateInstanceVersion");
+    if (enumerateInstanceVersion != nullptr) enumerateInstanceVersion(&instanceApiVersion);
+    instanceApiVersion = std::min<uint32_t>(instanceApiVersion, VK_API_VERSION_1_3);
+    appInfo.apiVersion = instanceApiVersion;
 
     /* Tells Vulkan driver what global extensions and validation layers we want */
     VkInstanceCreateInfo createInfo {};
@@ -156,89 +465,90 @@ HelloTriangleApplication::createInstance() {
     }
 
     /* Create the instance */
-    if (vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS)
+    if (vkCreateInstance(&createInfo, instanceCallbacks, &instance) != VK_SUCCESS)
         throw std::runtime_error("Failed to create instance.");
 }
 
 void
 HelloTriangleApplication::createSurface() {
-    if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS)
+    if (glfwCreateWindowSurface(instance, window, instanceCallbacks, &surface) != VK_SUCCESS)
         throw std::runtime_error("Failed to create window surface.");
 }
 
 void
 HelloTriangleApplication::pickPhysicalDevice() {
-    uint32_t deviceCount = 0;
-    /* Get number of physical devices */
-    vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
-
-    if (deviceCount == 0)
-        throw std::runtime_error("Failed to find any GPUs with Vulkan support.");
-
-    std::vector<VkPhysicalDevice> devices(deviceCount);
-
-    /* Populate vector with available physical devices */
-    vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+    /* Everything needed to choose and set up the device is queried here, once per device */
+    DeviceSelector selector(instance, config.headless ? VK_NULL_HANDLE : surface);
+    deviceInfo = selector.select(
+            [this](const DeviceInfo& info) { return isDeviceSuitable(info); });
+
+    physicalDevice = deviceInfo.device;
+    queueFamilyIndices = findQueueFamilies(deviceInfo);
+    msaaSamples = chooseSampleCount(deviceInfo);
+}
 
-    for (const auto& device : devices)
-        if (isDeviceSuitable(device)) {
-            physicalDevice = device;
-            break;
-        }
+VkSampleCountFlagBits
+HelloTriangleApplication::chooseSampleCount(const DeviceInfo& info) {
+    /* Sample counts are single bits, so going down one bit at a time tries every lower one */
+    VkSampleCountFlags supported = info.properties.limits.framebufferColorSampleCounts;
+    for (uint32_t samples = config.pipelineVariant.samples; samples > 1; samples >>= 1)
+        if (supported & samples) return static_cast<VkSampleCountFlagBits>(samples);
 
-    if (physicalDevice == VK_NULL_HANDLE)
-        throw std::runtime_error("Failed to find a suitable GPU.");
+    return VK_SAMPLE_COUNT_1_BIT;
 }
 
 bool
-HelloTriangleApplication::isDeviceSuitable(VkPhysicalDevice device) {
+HelloTriangleApplication::isDeviceSuitable(const DeviceInfo& info) {
     return (
-        findQueueFamilies(device).isComplete() &&
-        checkDeviceExtensionSupport(device) &&
-        querySwapChainSupport(device).isComplete()
+        findQueueFamilies(info).isComplete() &&
+        checkDeviceExtensionSupport(info) &&
+        (config.headless || (!info.surfaceFormats.empty() && !info.presentationModes.empty()))
     );
 }
 
 HelloTriangleApplication::QueueFamilyIndices
-HelloTriangleApplication::findQueueFamilies(VkPhysicalDevice device) {
+HelloTriangleApplication::findQueueFamilies(const DeviceInfo& info) {
     QueueFamilyIndices indices;
 
-    uint32_t queueFamilyCount = 0;
-    /* Get number of available queue families */
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
-
-    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    /* Prefer a transfer-only family, usually backed by DMA engines that copy alongside rendering */
+    indices.transferFamily = info.findQueueFamily(
+            VK_QUEUE_TRANSFER_BIT, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT);
 
-    /* Populate vector with available queue families */
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+    /* Likewise a compute family without graphics, which can run alongside rasterization */
+    indices.computeFamily = info.findQueueFamily(VK_QUEUE_COMPUTE_BIT, VK_QUEUE_GRAPHICS_BIT);
 
-    uint32_t i = 0;
     /* Find a queue family with graphics capabilities and index it */
-    for (const auto& family : queueFamilies) {
-        if (family.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+    for (uint32_t i = 0; i < info.queueFamilies.size(); ++i) {
+        if (info.queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
             indices.graphicsFamily = i;
 
-        VkBool32 presentSupport = VK_FALSE;
-        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
-        if (presentSupport == VK_TRUE)
+        /* Nothing is presented when headless; alias presentation to the graphics family */
+        if (config.headless)
+            indices.presentationFamily = indices.graphicsFamily;
+        else if (info.presentationSupport[i] == VK_TRUE)
             indices.presentationFamily = i;
 
         if (indices.isComplete()) break;
-
-        ++i;
     }
 
+    /* Graphics queues can always copy too, and always compute as well */
+    if (!indices.transferFamily.has_value())
+        indices.transferFamily = indices.graphicsFamily;
+    if (!indices.computeFamily.has_value())
+        indices.computeFamily = indices.graphicsFamily;
+
     return indices;
 }
 
 void
 HelloTriangleApplication::createLogicalDevice() {
-    QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+    const QueueFamilyIndices& indices = queueFamilyIndices;
 
     /* Set up required queues */
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
     std::set<uint32_t> uniqueQueueFamilies = {
-        indices.graphicsFamily.value(), indices.presentationFamily.value()
+        indices.graphicsFamily.value(), indices.presentationFamily.value(),
+        indices.transferFamily.value(), indices.computeFamily.value()
     };
     /* Assign the highest priority to the queues */
     float queuePriority = 1.f;
@@ -251,21 +561,81 @@ HelloTriangleApplication::createLogicalDevice() {
         queueCreateInfos.push_back(queueCreateInfo);
     }
 
-    /* Specify device features */
+    /* Specify device features; only those needed by optional paths in use are enabled */
     VkPhysicalDeviceFeatures deviceFeatures {};
-    /* Don't need anything special right now, can leave everything as is */
-    (void) deviceFeatures;
+
+    /* Culling on the GPU draws each surviving instance with a draw of its own */
+    useGpuCulling = checkGpuCullingSupport(deviceInfo);
+    deviceFeatures.multiDrawIndirect = useGpuCulling ? VK_TRUE : VK_FALSE;
+    deviceFeatures.drawIndirectFirstInstance = useGpuCulling ? VK_TRUE : VK_FALSE;
+
+    /* Let the GPU say how many draws survived if it can (core in Vulkan 1.2, an extension
+     * before); otherwise the culled draws are left in the buffer as empty ones */
+    bool drawIndirectCountCore = useGpuCulling && checkDrawIndirectCountSupport(deviceInfo);
+    useDrawIndirectCount = drawIndirectCountCore || (useGpuCulling &&
+            deviceInfo.hasExtension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME));
+
+    /* Optional features are chained in front of each other as they are enabled */
+    void *featureChain = nullptr;
+
+    /* Enable timeline semaphores if we can, falling back to fences otherwise */
+    useTimelineSemaphore = checkTimelineSemaphoreSupport(deviceInfo);
+    VkPhysicalDeviceVulkan12Features vulkan12Features {};
+    vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    vulkan12Features.timelineSemaphore = useTimelineSemaphore ? VK_TRUE : VK_FALSE;
+    vulkan12Features.drawIndirectCount = drawIndirectCountCore ? VK_TRUE : VK_FALSE;
+    if (useTimelineSemaphore || drawIndirectCountCore) {
+        vulkan12Features.pNext = featureChain;
+        featureChain = &vulkan12Features;
+    }
+
+    /* Enable extended dynamic state if we can, baking that state into pipelines otherwise */
+    useExtendedDynamicState = checkExtendedDynamicStateSupport(deviceInfo);
+    VkPhysicalDeviceExtendedDynamicStateFeaturesEXT dynamicStateFeatures {};
+    dynamicStateFeatures.sType =
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT;
+    dynamicStateFeatures.extendedDynamicState = VK_TRUE;
+    if (useExtendedDynamicState) {
+        dynamicStateFeatures.pNext = featureChain;
+        featureChain = &dynamicStateFeatures;
+    }
+
+    /* Render without render pass objects if we can, through the render pass otherwise.
+     * Both features are core in Vulkan 1.3, where these structures may still be chained */
+    bool dynamicRenderingCore = false;
+    useDynamicRendering = checkDynamicRenderingSupport(deviceInfo, dynamicRenderingCore);
+    VkPhysicalDeviceDynamicRenderingFeatures dynamicRenderingFeatures {};
+    dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
+    dynamicRenderingFeatures.dynamicRendering = VK_TRUE;
+    VkPhysicalDeviceSynchronization2Features synchronization2Features {};
+    synchronization2Features.sType =
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES;
+    synchronization2Features.synchronization2 = VK_TRUE;
+    if (useDynamicRendering) {
+        dynamicRenderingFeatures.pNext = featureChain;
+        synchronization2Features.pNext = &dynamicRenderingFeatures;
+        featureChain = &synchronization2Features;
+    }
 
     /* Set up the logical device */
     VkDeviceCreateInfo createInfo {};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    createInfo.pNext = featureChain;
     createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
     createInfo.pQueueCreateInfos = queueCreateInfos.data();
     createInfo.pEnabledFeatures = &deviceFeatures;
 
-    /* Add in requested extensions */
-    createInfo.enabledExtensionCount = static_cast<uint32_t>(requestedExtensions.size());
-    createInfo.ppEnabledExtensionNames = requestedExtensions.data();
+    /* Add in requested extensions, and the optional ones in use */
+    auto deviceExtensions = getRequiredDeviceExtensions();
+    if (useExtendedDynamicState)
+        deviceExtensions.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME);
+    if (useDrawIndirectCount && !drawIndirectCountCore)
+        deviceExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    if (useDynamicRendering && !dynamicRenderingCore)
+        deviceExtensions.insert(deviceExtensions.end(), { VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME,
+                VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME });
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
+    createInfo.ppEnabledExtensionNames = deviceExtensions.data();
 
     /* Instance and device now have same validation layers; this is for backwards compatibility */
     if (enableValidationLayers) {
@@ -274,44 +644,180 @@ HelloTriangleApplication::createLogicalDevice() {
     } else
         createInfo.enabledLayerCount = 0;
 
-    if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &logicalDevice) != VK_SUCCESS)
+    if (vkCreateDevice(physicalDevice, &createInfo, deviceCallbacks, &logicalDevice) != VK_SUCCESS)
         throw std::runtime_error("Failed to create logical device.");
 
     vkGetDeviceQueue(logicalDevice, indices.graphicsFamily.value(), 0, &graphicsQueue);
     vkGetDeviceQueue(logicalDevice, indices.presentationFamily.value(), 0, &presentationQueue);
+    vkGetDeviceQueue(logicalDevice, indices.transferFamily.value(), 0, &transferQueue);
+    graphicsFamily = indices.graphicsFamily.value();
+    transferFamily = indices.transferFamily.value();
+    vkGetDeviceQueue(logicalDevice, indices.computeFamily.value(), 0, &computeQueue);
+    computeFamily = indices.computeFamily.value();
+
+    if (useTimelineSemaphore) {
+        pfnWaitSemaphores = (PFN_vkWaitSemaphores)
+                        vkGetDeviceProcAddr(logicalDevice, "vkWaitSemaphores");
+        pfnGetSemaphoreCounterValue = (PFN_vkGetSemaphoreCounterValue)
+                        vkGetDeviceProcAddr(logicalDevice, "vkGetSemaphoreCounterValue");
+        if (pfnWaitSemaphores == nullptr || pfnGetSemaphoreCounterValue == nullptr)
+            throw std::runtime_error("Failed to load timeline semaphore functions.");
+    }
+
+    if (useExtendedDynamicState) {
+        pfnCmdSetCullMode = (PFN_vkCmdSetCullModeEXT)
+                        vkGetDeviceProcAddr(logicalDevice, "vkCmdSetCullModeEXT");
+        pfnCmdSetFrontFace = (PFN_vkCmdSetFrontFaceEXT)
+                        vkGetDeviceProcAddr(logicalDevice, "vkCmdSetFrontFaceEXT");
+        pfnCmdSetPrimitiveTopology = (PFN_vkCmdSetPrimitiveTopologyEXT)
+                        vkGetDeviceProcAddr(logicalDevice, "vkCmdSetPrimitiveTopologyEXT");
+        if (pfnCmdSetCullMode == nullptr || pfnCmdSetFrontFace == nullptr ||
+                pfnCmdSetPrimitiveTopology == nullptr)
+            throw std::runtime_error("Failed to load extended dynamic state functions.");
+    }
+
+    if (useDrawIndirectCount) {
+        pfnCmdDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCount)
+                        vkGetDeviceProcAddr(logicalDevice, drawIndirectCountCore
+                                                           ? "vkCmdDrawIndexedIndirectCount"
+                                                           : "vkCmdDrawIndexedIndirectCountKHR");
+        if (pfnCmdDrawIndexedIndirectCount == nullptr)
+            throw std::runtime_error("Failed to load indirect count draw function.");
+    }
+
+    if (useDynamicRendering) {
+        pfnCmdBeginRendering = (PFN_vkCmdBeginRendering)vkGetDeviceProcAddr(logicalDevice,
+                dynamicRenderingCore ? "vkCmdBeginRendering" : "vkCmdBeginRenderingKHR");
+        pfnCmdEndRendering = (PFN_vkCmdEndRendering)vkGetDeviceProcAddr(logicalDevice,
+                dynamicRenderingCore ? "vkCmdEndRendering" : "vkCmdEndRenderingKHR");
+        pfnCmdPipelineBarrier2 = (PFN_vkCmdPipelineBarrier2)vkGetDeviceProcAddr(logicalDevice,
+                dynamicRenderingCore ? "vkCmdPipelineBarrier2" : "vkCmdPipelineBarrier2KHR");
+        if (pfnCmdBeginRendering == nullptr || pfnCmdEndRendering == nullptr ||
+                pfnCmdPipelineBarrier2 == nullptr)
+            throw std::runtime_error("Failed to load dynamic rendering functions.");
+    }
+
+    deviceAllocator = std::make_unique<DeviceAllocator>(physicalDevice, logicalDevice,
+                                                        deviceCallbacks);
+}
+
+bool
+HelloTriangleApplication::checkTimelineSemaphoreSupport(const DeviceInfo& info) {
+    /* Timeline semaphores are core in Vulkan 1.2, on both the instance and device side */
+    if (!config.allowTimelineSemaphore || instanceApiVersion < VK_API_VERSION_1_2) return false;
+    if (info.properties.apiVersion < VK_API_VERSION_1_2) return false;
+
+    VkPhysicalDeviceVulkan12Features vulkan12Features {};
+    vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    VkPhysicalDeviceFeatures2 features {};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &vulkan12Features;
+    vkGetPhysicalDeviceFeatures2(info.device, &features);
+
+    return vulkan12Features.timelineSemaphore == VK_TRUE;
+}
+
+bool
+HelloTriangleApplication::checkExtendedDynamicStateSupport(const DeviceInfo& info) {
+    /* Querying the feature takes vkGetPhysicalDeviceFeatures2, core since Vulkan 1.1 */
+    if (!config.allowExtendedDynamicState || instanceApiVersion < VK_API_VERSION_1_1)
+        return false;
+    if (!info.hasExtension(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME)) return false;
+
+    VkPhysicalDeviceExtendedDynamicStateFeaturesEXT dynamicStateFeatures {};
+    dynamicStateFeatures.sType =
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT;
+    VkPhysicalDeviceFeatures2 features {};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &dynamicStateFeatures;
+    vkGetPhysicalDeviceFeatures2(info.device, &features);
+
+    return dynamicStateFeatures.extendedDynamicState == VK_TRUE;
+}
+
+bool
+HelloTriangleApplication::checkGpuCullingSupport(const DeviceInfo& info) {
+    /* Every instance may get a draw, all of which are issued by a single indirect call */
+    return config.gpuDriven &&
+           info.features.multiDrawIndirect == VK_TRUE &&
+           info.features.drawIndirectFirstInstance == VK_TRUE &&
+           info.properties.limits.maxDrawIndirectCount >= config.instanceCount;
 }
 
 bool
-HelloTriangleApplication::checkDeviceExtensionSupport(VkPhysicalDevice device) {
-    uint32_t extensionCount = 0;
-    /* Count the number of available extensions */
-    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+HelloTriangleApplication::checkDrawIndirectCountSupport(const DeviceInfo& info) {
+    if (instanceApiVersion < VK_API_VERSION_1_2 ||
+            info.properties.apiVersion < VK_API_VERSION_1_2)
+        return false;
+
+    VkPhysicalDeviceVulkan12Features vulkan12Features {};
+    vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    VkPhysicalDeviceFeatures2 features {};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &vulkan12Features;
+    vkGetPhysicalDeviceFeatures2(info.device, &features);
+
+    return vulkan12Features.drawIndirectCount == VK_TRUE;
+}
 
-    std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+bool
+HelloTriangleApplication::checkDynamicRenderingSupport(const DeviceInfo& info, bool& core) {
+    /* The extensions depend on others that are only all core from Vulkan 1.2 on */
+    if (!config.allowDynamicRendering || instanceApiVersion < VK_API_VERSION_1_2 ||
+            info.properties.apiVersion < VK_API_VERSION_1_2)
+        return false;
+
+    core = instanceApiVersion >= VK_API_VERSION_1_3 &&
+           info.properties.apiVersion >= VK_API_VERSION_1_3;
+    if (!core && (!info.hasExtension(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME) ||
+                  !info.hasExtension(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME)))
+        return false;
+
+    VkPhysicalDeviceDynamicRenderingFeatures dynamicRenderingFeatures {};
+    dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
+    VkPhysicalDeviceSynchronization2Features synchronization2Features {};
+    synchronization2Features.sType =
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES;
+    synchronization2Features.pNext = &dynamicRenderingFeatures;
+    VkPhysicalDeviceFeatures2 features {};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &synchronization2Features;
+    vkGetPhysicalDeviceFeatures2(info.device, &features);
+
+    return dynamicRenderingFeatures.dynamicRendering == VK_TRUE &&
+           synchronization2Features.synchronization2 == VK_TRUE;
+}
 
-    /* Populate the vector with the available extensions */
-    vkEnumerateDeviceExtensionProperties
-        (device, nullptr, &extensionCount, availableExtensions.data());
+std::vector<const char *>
+HelloTriangleApplication::getRequiredDeviceExtensions() {
+    /* Without a swap chain there is nothing extra to ask for */
+    if (config.headless) return {};
 
-    std::set<std::string> requestedExtensionSet
-                            (requestedExtensions.begin(), requestedExtensions.end());
+    return requestedExtensions;
+}
 
-    for (const auto& extension : availableExtensions)
-        requestedExtensionSet.erase(extension.extensionName);
+bool
+HelloTriangleApplication::checkDeviceExtensionSupport(const DeviceInfo& info) {
+    auto deviceExtensions = getRequiredDeviceExtensions();
 
-    return requestedExtensionSet.empty();
+    return std::all_of(deviceExtensions.begin(), deviceExtensions.end(),
+            [&info](const char *extension) { return info.hasExtension(extension); });
 }
 
 void
 HelloTriangleApplication::createSwapChain() {
-    SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
+    SwapChainSupportDetails swapChainSupport = querySwapChainSupport();
 
     VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.surfaceFormats);
     VkPresentModeKHR presentationMode = chooseSwapPresentationMode(swapChainSupport.presentationModes);
     VkExtent2D extent = chooseSwapExtent(swapChainSupport.surfaceCapabilities);
 
-    /* Add 1 to minimum number of images in chain to give driver time to perform operations */
-    uint32_t imageCount = swapChainSupport.surfaceCapabilities.minImageCount + 1;
+    /* Add images beyond the minimum as the profile asks, to give the driver time to perform
+     * operations */
+    PresentPolicy policy = getPresentPolicy(presentProfile);
+    uint32_t imageCount = std::max(
+            swapChainSupport.surfaceCapabilities.minImageCount + policy.extraImages,
+            policy.minImageCount);
     if (swapChainSupport.surfaceCapabilities.maxImageCount > 0 &&
             imageCount > swapChainSupport.surfaceCapabilities.maxImageCount)
         imageCount = swapChainSupport.surfaceCapabilities.maxImageCount;
@@ -325,16 +831,24 @@ HelloTriangleApplication::createSwapChain() {
     createInfo.imageExtent = extent;
     createInfo.imageArrayLayers = 1; /* Always one unless we're doing stereoscopic 3D */
     createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    /* Captured frames are copied out of the images */
+    if (config.capturesFrames()) {
+        if (!(swapChainSupport.surfaceCapabilities.supportedUsageFlags &
+                VK_IMAGE_USAGE_TRANSFER_SRC_BIT))
+            throw std::runtime_error("Failed to capture frames: the swap chain images can't be "
+                                     "copied from.");
+        createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    }
 
-    QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
-    uint32_t queueFamilyIndices[] = { indices.graphicsFamily.value(),
-                                      indices.presentationFamily.value() };
+    const QueueFamilyIndices& indices = queueFamilyIndices;
+    uint32_t sharingFamilies[] = { indices.graphicsFamily.value(),
+                                   indices.presentationFamily.value() };
 
     if (indices.graphicsFamily != indices.presentationFamily) {
         /* If two different queue families are used, handle them concurrently */
         createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
         createInfo.queueFamilyIndexCount = 2;
-        createInfo.pQueueFamilyIndices = queueFamilyIndices;
+        createInfo.pQueueFamilyIndices = sharingFamilies;
     } else {
         /* Otherwise, use them exclusively (faster) */
         createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
@@ -348,9 +862,10 @@ HelloTriangleApplication::createSwapChain() {
     createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     createInfo.presentMode = presentationMode;
     createInfo.clipped = VK_TRUE; /* Ignore pixel colors behind window */
-    createInfo.oldSwapchain = VK_NULL_HANDLE; /* Swap chain could become invalid or unoptimized */
+    /* Hand over the swap chain being replaced (if any) so the driver can reuse its resources */
+    createInfo.oldSwapchain = swapChain;
 
-    if (vkCreateSwapchainKHR(logicalDevice, &createInfo, nullptr, &swapChain) != VK_SUCCESS)
+    if (vkCreateSwapchainKHR(logicalDevice, &createInfo, deviceCallbacks, &swapChain) != VK_SUCCESS)
         throw std::runtime_error("Failed to create swap chain.");
 
     /* Store images and information as member variables */
@@ -359,33 +874,19 @@ HelloTriangleApplication::createSwapChain() {
     vkGetSwapchainImagesKHR(logicalDevice, swapChain, &imageCount, swapChainImages.data());
     swapChainImageFormat = surfaceFormat.format;
     swapChainExtent = extent;
+    swapChainPresentMode = presentationMode;
 }
 
 HelloTriangleApplication::SwapChainSupportDetails
-HelloTriangleApplication::querySwapChainSupport(VkPhysicalDevice device) {
+HelloTriangleApplication::querySwapChainSupport() {
     SwapChainSupportDetails details;
 
-    /* Determine supported capabilities */
-    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface, &details.surfaceCapabilities);
-
-    uint32_t formatCount;
-    uint32_t presentationModeCount;
-    /* Count the number of available surface formats */
-    vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, nullptr);
-    /* Count the number of available presentation modes */
-    vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &presentationModeCount, nullptr);
+    /* Capabilities follow the window size, so only they are queried again every time */
+    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(
+            physicalDevice, surface, &details.surfaceCapabilities);
 
-    if (formatCount != 0) {
-        details.surfaceFormats.resize(formatCount);
-        vkGetPhysicalDeviceSurfaceFormatsKHR(
-                device, surface, &formatCount, details.surfaceFormats.data());
-    }
-
-    if (presentationModeCount != 0) {
-        details.presentationModes.resize(presentationModeCount);
-        vkGetPhysicalDeviceSurfacePresentModesKHR(
-                device, surface, &presentationModeCount, details.presentationModes.data());
-    }
+    details.surfaceFormats = deviceInfo.surfaceFormats;
+    details.presentationModes = deviceInfo.presentationModes;
 
     return details;
 }
@@ -404,14 +905,54 @@ HelloTriangleApplication::chooseSwapSurfaceFormat(
     return availableFormats[0];
 }
 
+HelloTriangleApplication::PresentPolicy
+HelloTriangleApplication::getPresentPolicy(PresentProfile profile) {
+    switch (profile) {
+        case PresentProfile::LowLatency:
+            /* Show frames as soon as they're done, tearing if need be */
+            return { { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR }, 1, 0, 0 };
+        case PresentProfile::Throughput:
+            /* Keep the GPU fed; never block on the display */
+            return { { VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_RELAXED_KHR },
+                     MAX_PROFILE_FRAMES_IN_FLIGHT, 3, 1 };
+        case PresentProfile::PowerSaving:
+            /* Render no faster than the display refreshes */
+            return { { VK_PRESENT_MODE_FIFO_KHR }, 2, 0, 1 };
+        case PresentProfile::Balanced:
+        default:
+            return { { VK_PRESENT_MODE_MAILBOX_KHR }, config.framesInFlight, 0, 1 };
+    }
+}
+
+void
+HelloTriangleApplication::applyRequestedPresentProfile() {
+    if (!requestedPresentProfile.has_value()) return;
+
+    presentProfile = requestedPresentProfile.value();
+    requestedPresentProfile.reset();
+    config.presentMode.reset(); /* An explicit mode only applies to the starting profile */
+
+    /* Slots beyond the new count simply go unused; their last frames still complete */
+    framesInFlight = getPresentPolicy(presentProfile).framesInFlight;
+    currentFrame %= framesInFlight;
+
+    if (!config.headless) recreateSwapChain();
+}
+
 VkPresentModeKHR
 HelloTriangleApplication::chooseSwapPresentationMode(
         const std::vector<VkPresentModeKHR>& availablePresentationModes) {
-    for (const auto& mode : availablePresentationModes) {
-        /* Look for mailbox presentation */
-        if (mode == VK_PRESENT_MODE_MAILBOX_KHR)
-            return mode;
-    }
+    /* Honor an explicitly requested mode when the surface supports it */
+    if (config.presentMode.has_value())
+        for (const auto& mode : availablePresentationModes)
+            if (mode == config.presentMode.value())
+                return mode;
+
+    /* Otherwise take the first mode the profile prefers */
+    for (const auto& preferred : getPresentPolicy(presentProfile).presentationModes)
+        for (const auto& mode : availablePresentationModes)
+            if (mode == preferred)
+                return mode;
 
     /* Default to regular FIFO presentation, which is guaranteed to be available */
     return VK_PRESENT_MODE_FIFO_KHR;
@@ -423,8 +964,10 @@ HelloTriangleApplication::chooseSwapExtent(const VkSurfaceCapabilitiesKHR capabi
     if (capabilities.currentExtent.width != UINT32_MAX)
         return capabilities.currentExtent;
 
-    /* Otherwise, determine the resolution manually */
-    VkExtent2D actualExtent = { WIDTH, HEIGHT };
+    /* Otherwise, determine the resolution manually from the window's framebuffer */
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    VkExtent2D actualExtent = { static_cast<uint32_t>(width), static_cast<uint32_t>(height) };
 
     actualExtent.width =
         std::max(capabilities.minImageExtent.width,
@@ -438,6 +981,95 @@ HelloTriangleApplication::chooseSwapExtent(const VkSurfaceCapabilitiesKHR capabi
     return actualExtent;
 }
 
+void
+HelloTriangleApplication::createOffscreenImages() {
+    swapChainImageFormat = HEADLESS_FORMAT;
+    swapChainExtent = { WIDTH, HEIGHT };
+    swapChainImages.resize(config.headlessImageCount);
+    offscreenImageMemory.resize(config.headlessImageCount);
+
+    for (size_t i = 0; i < swapChainImages.size(); ++i) {
+        /* Set up an image that can be rendered to and copied out of */
+        VkImageCreateInfo imageInfo {};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = swapChainImageFormat;
+        imageInfo.extent = { swapChainExtent.width, swapChainExtent.height, 1 };
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        if (vkCreateImage(logicalDevice, &imageInfo, deviceCallbacks, &swapChainImages[i])
+                != VK_SUCCESS)
+            throw std::runtime_error("Failed to create offscreen image.");
+
+        /* Back the image with device-local memory (optimal tiling, so not linear) */
+        VkMemoryRequirements memRequirements;
+        vkGetImageMemoryRequirements(logicalDevice, swapChainImages[i], &memRequirements);
+
+        offscreenImageMemory[i] = deviceAllocator->allocate(memRequirements,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false);
+        vkBindImageMemory(logicalDevice, swapChainImages[i], offscreenImageMemory[i].memory,
+                offscreenImageMemory[i].offset);
+    }
+}
+
+void
+HelloTriangleApplication::createColorResources() {
+    if (msaaSamples == VK_SAMPLE_COUNT_1_BIT) return;
+
+    /* Only ever a render target, so tile-based GPUs can keep it in on-chip memory */
+    VkImageCreateInfo imageInfo {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.format = swapChainImageFormat;
+    imageInfo.extent = { swapChainExtent.width, swapChainExtent.height, 1 };
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.samples = msaaSamples;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    if (vkCreateImage(logicalDevice, &imageInfo, deviceCallbacks, &colorImage) != VK_SUCCESS)
+        throw std::runtime_error("Failed to create multisampled color image.");
+
+    /* Lazily allocated memory is only committed if the image really needs it, which it
+     * doesn't when it stays on chip; not every device has such memory, though */
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(logicalDevice, colorImage, &memRequirements);
+
+    VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    for (uint32_t i = 0; i < deviceInfo.memoryProperties.memoryTypeCount; ++i)
+        if ((memRequirements.memoryTypeBits & (1u << i)) &&
+                (deviceInfo.memoryProperties.memoryTypes[i].propertyFlags &
+                 VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)) {
+            properties |= VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+            break;
+        }
+
+    colorImageMemory = deviceAllocator->allocate(memRequirements, properties, false);
+    vkBindImageMemory(logicalDevice, colorImage, colorImageMemory.memory,
+            colorImageMemory.offset);
+
+    VkImageViewCreateInfo viewInfo {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = colorImage;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = swapChainImageFormat;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    if (vkCreateImageView(logicalDevice, &viewInfo, deviceCallbacks, &colorImageView) != VK_SUCCESS)
+        throw std::runtime_error("Failed to create multisampled color image view.");
+}
+
 void
 HelloTriangleApplication::createImageViews() {
     swapChainImageViews.resize(swapChainImages.size());
@@ -465,65 +1097,439 @@ HelloTriangleApplication::createImageViews() {
         createInfo.subresourceRange.layerCount = 1; /* Multiple layers is for stereographic 3D */
 
         if (vkCreateImageView(
-                    logicalDevice, &createInfo, nullptr, &swapChainImageViews[i]) != VK_SUCCESS)
+                    logicalDevice, &createInfo, deviceCallbacks, &swapChainImageViews[i])
+                != VK_SUCCESS)
                 throw std::runtime_error("Failed to create image views.");
         ++i;
     }
 }
 
+void
+HelloTriangleApplication::recreateSwapChain() {
+    /* Nothing can be rendered while the window is minimized, so wait until it comes back */
+    int width = 0, height = 0;
+    glfwGetFramebufferSize(window, &width, &height);
+    while (width == 0 || height == 0) {
+        glfwWaitEvents();
+        glfwGetFramebufferSize(window, &width, &height);
+    }
+
+    /* Set the old objects aside instead of waiting for the device to go idle; frames that
+     * are still in flight keep using them until they complete */
+    RetiredSwapChain retired {};
+    retired.frameCount = frameNumber;
+    retired.swapChain = swapChain;
+    retired.imageViews = std::move(swapChainImageViews);
+    retired.framebuffers = std::move(swapChainFramebuffers);
+    retired.commandBuffers = std::move(commandBuffers);
+    retired.secondaryCommandBuffers = std::move(secondaryCommandBuffers);
+    retired.secondaryCommandPools = std::move(secondaryCommandPools);
+    retired.timestampQueryPool = timestampQueryPool;
+    timestampQueryPool = VK_NULL_HANDLE;
+    retired.animatedInstanceBuffer = animatedInstanceBuffer;
+    retired.animatedInstanceMemory = animatedInstanceMemory;
+    retired.computeDescriptorSet = computeDescriptorSet;
+    animatedInstanceBuffer = VK_NULL_HANDLE;
+    retired.indirectBuffer = indirectBuffer;
+    retired.indirectMemory = indirectMemory;
+    retired.drawCountBuffer = drawCountBuffer;
+    retired.drawCountMemory = drawCountMemory;
+    retired.cullDescriptorSet = cullDescriptorSet;
+    indirectBuffer = VK_NULL_HANDLE;
+    retired.colorImage = colorImage;
+    retired.colorImageView = colorImageView;
+    retired.colorImageMemory = colorImageMemory;
+    colorImage = VK_NULL_HANDLE;
+
+    /* Pipelines don't depend on the extent, the viewport and scissor are set when recording */
+    createSwapChain();
+    createImageViews();
+    createColorResources();
+
+    createFramebuffers();
+    /* Timings still pending for the old images are dropped along with their query pool */
+    createTimestampQueryPool();
+    /* The number of images may have changed, and every image has its own animated instances */
+    if (config.animateInstances) createAnimatedInstanceBuffer();
+    /* Likewise its draws, and the culling reads the new instance buffer */
+    if (useGpuCulling) createIndirectBuffers();
+    createCommandBuffers();
+
+    /* No image of the new swap chain has been used by a frame yet */
+    imagesInFlight.assign(swapChainImages.size(), VK_NULL_HANDLE);
+    imageFrameCounts.assign(swapChainImages.size(), 0);
+
+    retiredSwapChains.push_back(std::move(retired));
+}
+
+void
+HelloTriangleApplication::releaseRetiredSwapChains(bool releaseAll) {
+    auto it = retiredSwapChains.begin();
+    while (it != retiredSwapChains.end()) {
+        if (!releaseAll && completedFrameCount < it->frameCount) {
+            ++it;
+            continue;
+        }
+
+        if (!it->commandBuffers.empty())
+            vkFreeCommandBuffers(logicalDevice, commandPool,
+                    static_cast<uint32_t>(it->commandBuffers.size()), it->commandBuffers.data());
+        for (size_t i = 0; i < it->secondaryCommandBuffers.size(); ++i)
+            vkFreeCommandBuffers(logicalDevice, it->secondaryCommandPools[i],
+                    1, &it->secondaryCommandBuffers[i]);
+        for (auto framebuffer : it->framebuffers)
+            vkDestroyFramebuffer(logicalDevice, framebuffer, deviceCallbacks);
+        if (it->timestampQueryPool != VK_NULL_HANDLE)
+            vkDestroyQueryPool(logicalDevice, it->timestampQueryPool, deviceCallbacks);
+        if (it->animatedInstanceBuffer != VK_NULL_HANDLE) {
+            vkDestroyBuffer(logicalDevice, it->animatedInstanceBuffer, deviceCallbacks);
+            deviceAllocator->free(it->animatedInstanceMemory);
+            vkFreeDescriptorSets(logicalDevice, computeDescriptorPool, 1,
+                    &it->computeDescriptorSet);
+        }
+        if (it->indirectBuffer != VK_NULL_HANDLE) {
+            vkDestroyBuffer(logicalDevice, it->indirectBuffer, deviceCallbacks);
+            deviceAllocator->free(it->indirectMemory);
+            vkDestroyBuffer(logicalDevice, it->drawCountBuffer, deviceCallbacks);
+            deviceAllocator->free(it->drawCountMemory);
+            vkFreeDescriptorSets(logicalDevice, cullDescriptorPool, 1, &it->cullDescriptorSet);
+        }
+        if (it->colorImage != VK_NULL_HANDLE) {
+            vkDestroyImageView(logicalDevice, it->colorImageView, deviceCallbacks);
+            vkDestroyImage(logicalDevice, it->colorImage, deviceCallbacks);
+            deviceAllocator->free(it->colorImageMemory);
+        }
+        for (auto imageView : it->imageViews)
+            vkDestroyImageView(logicalDevice, imageView, deviceCallbacks);
+        vkDestroySwapchainKHR(logicalDevice, it->swapChain, deviceCallbacks);
+
+        it = retiredSwapChains.erase(it);
+    }
+}
+
 void
 HelloTriangleApplication::createRenderPass() {
+    /* Dynamic rendering names its attachments when it begins instead */
+    if (useDynamicRendering) return;
+
+    bool multisampled = msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+
     VkAttachmentDescription colorAttachment {};
     colorAttachment.format = swapChainImageFormat;
-    colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    colorAttachment.samples = msaaSamples;
     colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR; /* Clear attachment before rendering */
     colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE; /* Retain rendered contents */
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR; /* Present image in swap chain */
+    /* Present image in swap chain, or keep it ready to be copied out when headless */
+    colorAttachment.finalLayout = config.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                                  : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+    /* When multisampling, the samples are only needed until they are resolved at the end of
+     * the subpass, so they're never written out; the image drawn to receives the resolve */
+    VkAttachmentDescription resolveAttachment = colorAttachment;
+    if (multisampled) {
+        resolveAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        resolveAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    }
+    VkAttachmentDescription attachments[] = { colorAttachment, resolveAttachment };
 
     /* Specify subpass references */
     VkAttachmentReference colorAttachmentRef {};
     colorAttachmentRef.attachment = 0;
     colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    VkAttachmentReference resolveAttachmentRef {};
+    resolveAttachmentRef.attachment = 1;
+    resolveAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
     /* Set up subpasses */
     VkSubpassDescription subpass {};
     subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
     subpass.colorAttachmentCount = 1;
     subpass.pColorAttachments = &colorAttachmentRef;
+    subpass.pResolveAttachments = multisampled ? &resolveAttachmentRef : nullptr;
 
     /* Set up subpass dependencies for image layout transitions */
     VkSubpassDependency dependency {};
     dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
     dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.srcAccessMask = 0;
+    /* The multisampled image is shared by all frames, so the previous frame's writes to it
+     * must be done as well */
+    dependency.srcAccessMask = multisampled ? VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT : 0;
     dependency.dstSubpass = 0;
     dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
     dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
 
+    /* Captured frames are copied out of the image right after the pass */
+    VkSubpassDependency captureDependency {};
+    captureDependency.srcSubpass = 0;
+    captureDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    captureDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    captureDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+    captureDependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    captureDependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    VkSubpassDependency dependencies[] = { dependency, captureDependency };
+
     /* Set up render pass */
     VkRenderPassCreateInfo renderPassInfo {};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    renderPassInfo.attachmentCount = 1;
-    renderPassInfo.pAttachments = &colorAttachment;
+    renderPassInfo.attachmentCount = multisampled ? 2 : 1;
+    renderPassInfo.pAttachments = attachments;
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
+    renderPassInfo.dependencyCount = config.capturesFrames() ? 2 : 1;
+    renderPassInfo.pDependencies = dependencies;
 
-    if (vkCreateRenderPass(logicalDevice, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS)
+    if (vkCreateRenderPass(logicalDevice, &renderPassInfo, deviceCallbacks, &renderPass)
+            != VK_SUCCESS)
         throw std::runtime_error("Failed to create render pass.");
 }
 
+/* Identifies pipeline cache files written by this application ("HTPC") */
+static const uint32_t PIPELINE_CACHE_MAGIC = 0x43505448;
+
+void
+HelloTriangleApplication::createPipelineCache() {
+    std::vector<char> cacheData = loadPipelineCacheData();
+
+    /* Set up pipeline cache; starts empty if there is no usable data */
+    VkPipelineCacheCreateInfo createInfo {};
+    createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    createInfo.initialDataSize = cacheData.size();
+    createInfo.pInitialData = cacheData.empty() ? nullptr : cacheData.data();
+
+    if (vkCreatePipelineCache(logicalDevice, &createInfo, pipelineCallbacks, &pipelineCache)
+            != VK_SUCCESS)
+        throw std::runtime_error("Failed to create pipeline cache.");
+}
+
+std::vector<char>
+HelloTriangleApplication::loadPipelineCacheData() {
+    if (config.pipelineCachePath.empty()) return {};
+
+    std::ifstream file(config.pipelineCachePath, std::ios::binary);
+    if (!file.is_open()) return {};
+
+    PipelineCacheFileHeader header;
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header))) return {};
+
+    /* Only reuse data produced by exactly this device and driver build */
+    const VkPhysicalDeviceProperties& properties = deviceInfo.properties;
+
+    if (header.magic != PIPELINE_CACHE_MAGIC ||
+            header.vendorID != properties.vendorID ||
+            header.deviceID != properties.deviceID ||
+            header.driverVersion != properties.driverVersion ||
+            memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+        return {};
+
+    /* The size comes from disk too; a truncated or corrupt file must not make us allocate
+     * more than the file actually holds */
+    std::streampos dataStart = file.tellg();
+    file.seekg(0, std::ios::end);
+    std::streampos fileEnd = file.tellg();
+    if (dataStart < 0 || fileEnd < dataStart ||
+            header.dataSize > static_cast<uint64_t>(fileEnd - dataStart))
+        return {};
+    file.seekg(dataStart);
+
+    std::vector<char> data(header.dataSize);
+    if (!file.read(data.data(), data.size())) return {};
+
+    /* Double-check the driver's own header, which leads the cache data */
+    VkPipelineCacheHeaderVersionOne driverHeader;
+    if (data.size() < sizeof(driverHeader)) return {};
+    memcpy(&driverHeader, data.data(), sizeof(driverHeader));
+
+    if (driverHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+            driverHeader.vendorID != properties.vendorID ||
+            driverHeader.deviceID != properties.deviceID ||
+            memcmp(driverHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE)
+                != 0)
+        return {};
+
+    return data;
+}
+
+void
+HelloTriangleApplication::savePipelineCache() {
+    if (config.pipelineCachePath.empty()) return;
+
+    size_t dataSize = 0;
+    if (vkGetPipelineCacheData(logicalDevice, pipelineCache, &dataSize, nullptr) != VK_SUCCESS)
+        return;
+
+    std::vector<char> data(dataSize);
+    if (vkGetPipelineCacheData(logicalDevice, pipelineCache, &dataSize, data.data())
+            != VK_SUCCESS)
+        return;
+    data.resize(dataSize);
+
+    const VkPhysicalDeviceProperties& properties = deviceInfo.properties;
+
+    PipelineCacheFileHeader header {};
+    header.magic = PIPELINE_CACHE_MAGIC;
+    header.vendorID = properties.vendorID;
+    header.deviceID = properties.deviceID;
+    header.driverVersion = properties.driverVersion;
+    memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+    header.dataSize = data.size();
+
+    /* The directory may not exist yet on the first run; failing here fails the write below */
+    std::error_code error;
+    std::filesystem::path parent = std::filesystem::path(config.pipelineCachePath).parent_path();
+    if (!parent.empty()) std::filesystem::create_directories(parent, error);
+
+    /* Write to a temporary file and rename it over the old one, so a crash mid-write leaves
+     * the old cache in place. Without an fsync a crash of the whole system can still leave a
+     * short file behind, which the size check on loading rejects */
+    std::string tempPath = config.pipelineCachePath + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            std::cerr << "Warning: could not write pipeline cache." << std::endl;
+            return;
+        }
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(data.data(), data.size());
+        if (!file.flush()) {
+            file.close();
+            std::remove(tempPath.c_str());
+            std::cerr << "Warning: could not write pipeline cache." << std::endl;
+            return;
+        }
+    }
+
+    if (std::rename(tempPath.c_str(), config.pipelineCachePath.c_str()) != 0) {
+        std::remove(tempPath.c_str());
+        std::cerr << "Warning: could not replace pipeline cache." << std::endl;
+    }
+}
+
+#ifdef EMBED_SHADERS
+/* SPIR-V compiled into the program by the build (glslc -mfmt=num) */
+static constexpr uint32_t VERT_SHADER_CODE[] = {
+    #include "shader.vert.inc"
+};
+static constexpr uint32_t FRAG_SHADER_CODE[] = {
+    #include "shader.frag.inc"
+};
+static constexpr uint32_t COMP_SHADER_CODE[] = {
+    #include "shader.comp.inc"
+};
+static constexpr uint32_t CULL_SHADER_CODE[] = {
+    #include "cull.comp.inc"
+};
+#endif
+
+void
+HelloTriangleApplication::loadShaderCode() {
+    #ifdef EMBED_SHADERS
+    if (config.shaderDir.empty()) {
+        vertShaderCode = ShaderBinary::fromMemory(VERT_SHADER_CODE, sizeof(VERT_SHADER_CODE));
+        fragShaderCode = ShaderBinary::fromMemory(FRAG_SHADER_CODE, sizeof(FRAG_SHADER_CODE));
+        compShaderCode = ShaderBinary::fromMemory(COMP_SHADER_CODE, sizeof(COMP_SHADER_CODE));
+        cullShaderCode = ShaderBinary::fromMemory(CULL_SHADER_CODE, sizeof(CULL_SHADER_CODE));
+        return;
+    }
+    #endif
+
+    std::string directory = config.shaderDir.empty() ? "build" : config.shaderDir;
+    vertShaderCode = ShaderBinary::fromFile(directory + "/shader.vert.spv");
+    fragShaderCode = ShaderBinary::fromFile(directory + "/shader.frag.spv");
+    if (config.animateInstances)
+        compShaderCode = ShaderBinary::fromFile(directory + "/shader.comp.spv");
+    if (config.gpuDriven)
+        cullShaderCode = ShaderBinary::fromFile(directory + "/cull.comp.spv");
+}
+
 void
 HelloTriangleApplication::createGraphicsPipeline() {
-    std::vector<char> vertShaderBuf = readFile("build/shader.vert.spv");
-    std::vector<char> fragShaderBuf = readFile("build/shader.frag.spv");
+    /* Modules are kept for as long as variants may be built from them */
+    vertShaderModule = createShaderModule(vertShaderCode);
+    fragShaderModule = createShaderModule(fragShaderCode);
+
+    /* Set up pipeline layout for specifying uniform values for shaders at draw time */
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 0;
+    pipelineLayoutInfo.pSetLayouts = nullptr;
+    pipelineLayoutInfo.pushConstantRangeCount = 0;
+    pipelineLayoutInfo.pPushConstantRanges = nullptr;
+    if (vkCreatePipelineLayout(
+            logicalDevice, &pipelineLayoutInfo, pipelineCallbacks, &pipelineLayout) != VK_SUCCESS)
+        throw std::runtime_error("Failed to create pipeline layout.");
+
+    pipelineRegistry = std::make_unique<PipelineRegistry>(logicalDevice,
+            [this](const PipelineVariant& variant) { return buildGraphicsPipeline(variant); },
+            pipelineCallbacks);
+    graphicsPipeline = pipelineRegistry->get(getBakedVariant(config.pipelineVariant));
+    prewarmPipelines();
+}
+
+PipelineVariant
+HelloTriangleApplication::getBakedVariant(const PipelineVariant& variant) {
+    /* The attachments decide the sample count, which may be less than asked for */
+    PipelineVariant baked = variant;
+    baked.samples = msaaSamples;
+    if (!useExtendedDynamicState) return baked;
+
+    /* Cull mode is entirely dynamic, but the topology can only change within its class */
+    baked.cullMode = VK_CULL_MODE_NONE;
+    switch (variant.topology) {
+        case VK_PRIMITIVE_TOPOLOGY_POINT_LIST:
+        case VK_PRIMITIVE_TOPOLOGY_PATCH_LIST:
+            break;
+        case VK_PRIMITIVE_TOPOLOGY_LINE_LIST:
+        case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP:
+        case VK_PRIMITIVE_TOPOLOGY_LINE_LIST_WITH_ADJACENCY:
+        case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP_WITH_ADJACENCY:
+            baked.topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
+            break;
+        default:
+            baked.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    }
+    return baked;
+}
+
+void
+HelloTriangleApplication::prewarmPipelines() {
+    if (!config.prewarmPipelines) return;
+
+    /* Every blend and cull mode, keeping the rest of the configured variant */
+    std::vector<PipelineVariant> variants;
+    for (BlendMode blend : { BlendMode::Opaque, BlendMode::Alpha, BlendMode::Additive })
+        for (VkCullModeFlags cullMode : { VK_CULL_MODE_NONE, VK_CULL_MODE_FRONT_BIT,
+                                          VK_CULL_MODE_BACK_BIT }) {
+            PipelineVariant variant = config.pipelineVariant;
+            variant.blend = blend;
+            variant.cullMode = cullMode;
+            variants.push_back(getBakedVariant(variant));
+        }
+
+    pipelineRegistry->prewarm(std::move(variants));
+}
+
+VkPipeline
+HelloTriangleApplication::buildGraphicsPipeline(const PipelineVariant& variant) {
+    /* Set up specialization constants of the fragment shader; ids match the shader */
+    struct {
+        uint32_t colorMode;
+        float alpha;
+    } specializationData = { variant.colorMode, variant.alpha / 255.f };
+    VkSpecializationMapEntry specializationEntries[2] = {
+        { 0, offsetof(decltype(specializationData), colorMode), sizeof(uint32_t) },
+        { 1, offsetof(decltype(specializationData), alpha), sizeof(float) },
+    };
 
-    VkShaderModule vertShaderModule = createShaderModule(vertShaderBuf);
-    VkShaderModule fragShaderModule = createShaderModule(fragShaderBuf);
+    VkSpecializationInfo specializationInfo {};
+    specializationInfo.mapEntryCount = 2;
+    specializationInfo.pMapEntries = specializationEntries;
+    specializationInfo.dataSize = sizeof(specializationData);
+    specializationInfo.pData = &specializationData;
 
     /* Set up vertex shader stage */
     VkPipelineShaderStageCreateInfo vertShaderStageInfo {};
@@ -539,48 +1545,50 @@ HelloTriangleApplication::createGraphicsPipeline() {
     fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT; /* Specify pipeline stage */
     fragShaderStageInfo.module = fragShaderModule;
     fragShaderStageInfo.pName = "main"; /* Entrypoint function name */
-    fragShaderStageInfo.pSpecializationInfo = nullptr; /* Can be used to specify constant values */
+    fragShaderStageInfo.pSpecializationInfo = &specializationInfo; /* Constant values */
 
     VkPipelineShaderStageCreateInfo shaderStages[] = 
         { vertShaderStageInfo, fragShaderStageInfo };
 
-    /* Set up vertex data (i.e. bindings, attributes) */
+    /* Set up vertex data (i.e. bindings, attributes): binding 0 steps per vertex through the
+     * mesh, binding 1 steps per instance */
+    VkVertexInputBindingDescription bindings[2] {};
+    bindings[0].binding = 0;
+    bindings[0].stride = sizeof(Vertex);
+    bindings[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    bindings[1].binding = 1;
+    bindings[1].stride = sizeof(InstanceData);
+    bindings[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+    /* Locations match the inputs of the vertex shader */
+    VkVertexInputAttributeDescription attributes[4] {};
+    attributes[0] = { 0, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(Vertex, position) };
+    attributes[1] = { 1, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, color) };
+    attributes[2] = { 2, 1, VK_FORMAT_R32G32_SFLOAT, offsetof(InstanceData, offset) };
+    attributes[3] = { 3, 1, VK_FORMAT_R32_SFLOAT, offsetof(InstanceData, scale) };
+
     VkPipelineVertexInputStateCreateInfo vertexInputInfo {};
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputInfo.vertexBindingDescriptionCount = 0;
-    vertexInputInfo.pVertexBindingDescriptions = nullptr;
-    vertexInputInfo.vertexAttributeDescriptionCount = 0;
-    vertexInputInfo.pVertexAttributeDescriptions = nullptr;
+    vertexInputInfo.vertexBindingDescriptionCount = 2;
+    vertexInputInfo.pVertexBindingDescriptions = bindings;
+    vertexInputInfo.vertexAttributeDescriptionCount = 4;
+    vertexInputInfo.pVertexAttributeDescriptions = attributes;
 
     /* Set up geometry topology information */
     VkPipelineInputAssemblyStateCreateInfo inputAssembly {};
     inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    /* Draw triangle from every 3 vertices without reuse */
-    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    /* Draw triangle from every 3 vertices without reuse, unless the variant says otherwise */
+    inputAssembly.topology = variant.topology;
     /* Can use primitive restart to manually specify indices to be loaded */
     inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-    /* Set up viewport (i.e. tranformation from image to framebuffer) */
-    VkViewport viewport {};
-    viewport.x = 0.f;
-    viewport.y = 0.f;
-    /* Swap chain image dimensions may differ from window, but will be used as framebuffers */
-    viewport.width = (float) swapChainExtent.width;
-    viewport.height = (float) swapChainExtent.height;
-    viewport.minDepth = 0.f;
-    viewport.maxDepth = 1.f;
-
-    /* Set up scissors (i.e. region inside which to store pixels) */
-    VkRect2D scissor {};
-    scissor.offset = { 0, 0 };
-    scissor.extent = swapChainExtent;
-
+    /* One viewport and scissor, both set when recording so the pipeline fits any extent */
     VkPipelineViewportStateCreateInfo viewportState {};
     viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
     viewportState.viewportCount = 1;
-    viewportState.pViewports = &viewport;
+    viewportState.pViewports = nullptr;
     viewportState.scissorCount = 1;
-    viewportState.pScissors = &scissor;
+    viewportState.pScissors = nullptr;
 
     /* Set up rasterizer to convert vertex geometry into fragments */
     VkPipelineRasterizationStateCreateInfo rasterizer {};
@@ -590,7 +1598,7 @@ HelloTriangleApplication::createGraphicsPipeline() {
     rasterizer.rasterizerDiscardEnable = VK_FALSE; /* If VK_TRUE, disables rasterization stage */
     rasterizer.polygonMode = VK_POLYGON_MODE_FILL; /* Determines how to generate fragments */
     rasterizer.lineWidth = 1.f;
-    rasterizer.cullMode = VK_CULL_MODE_BACK_BIT; /* Type of face culling */
+    rasterizer.cullMode = variant.cullMode; /* Type of face culling */
     rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE; /* Vertex order to determine orientation */
     /* Can manually configure depth values; useful for shadow mapping */
     rasterizer.depthBiasEnable = VK_FALSE;
@@ -602,7 +1610,7 @@ HelloTriangleApplication::createGraphicsPipeline() {
     VkPipelineMultisampleStateCreateInfo multisampling {};
     multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
     multisampling.sampleShadingEnable = VK_FALSE;
-    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    multisampling.rasterizationSamples = variant.samples;
     multisampling.minSampleShading = 1.f;
     multisampling.pSampleMask = nullptr;
     multisampling.alphaToCoverageEnable = VK_FALSE;
@@ -614,9 +1622,11 @@ HelloTriangleApplication::createGraphicsPipeline() {
                                           VK_COLOR_COMPONENT_G_BIT |
                                           VK_COLOR_COMPONENT_B_BIT |
                                           VK_COLOR_COMPONENT_A_BIT;
-    colorBlendAttachment.blendEnable = VK_FALSE;
-    colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-    colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+    colorBlendAttachment.blendEnable = variant.blend != BlendMode::Opaque;
+    colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+    colorBlendAttachment.dstColorBlendFactor = variant.blend == BlendMode::Additive
+                                                   ? VK_BLEND_FACTOR_ONE
+                                                   : VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
     colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
     colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
     colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
@@ -633,16 +1643,18 @@ HelloTriangleApplication::createGraphicsPipeline() {
     colorBlending.blendConstants[2] = 0.f;
     colorBlending.blendConstants[3] = 0.f;
 
-    /* Set up pipeline layout for specifying uniform values for shaders at draw time */
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo {};
-    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 0;
-    pipelineLayoutInfo.pSetLayouts = nullptr;
-    pipelineLayoutInfo.pushConstantRangeCount = 0;
-    pipelineLayoutInfo.pPushConstantRanges = nullptr;
-    if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &pipelineLayout)
-            != VK_SUCCESS)
-        throw std::runtime_error("Failed to create pipeline layout.");
+    /* Set up the state left to command buffers */
+    std::vector<VkDynamicState> dynamicStates = {
+        VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR
+    };
+    if (useExtendedDynamicState)
+        dynamicStates.insert(dynamicStates.end(), { VK_DYNAMIC_STATE_CULL_MODE_EXT,
+                VK_DYNAMIC_STATE_FRONT_FACE_EXT, VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY_EXT });
+
+    VkPipelineDynamicStateCreateInfo dynamicState {};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+    dynamicState.pDynamicStates = dynamicStates.data();
 
     VkGraphicsPipelineCreateInfo pipelineInfo {};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
@@ -655,34 +1667,39 @@ HelloTriangleApplication::createGraphicsPipeline() {
     pipelineInfo.pMultisampleState = &multisampling;
     pipelineInfo.pDepthStencilState = nullptr;
     pipelineInfo.pColorBlendState = &colorBlending;
-    pipelineInfo.pDynamicState = nullptr; /* Can be used to change some state at draw time */
+    pipelineInfo.pDynamicState = &dynamicState; /* State set at draw time instead */
     pipelineInfo.layout = pipelineLayout;
     pipelineInfo.renderPass = renderPass;
     pipelineInfo.subpass = 0;
+
+    /* Without a render pass, the pipeline is told the formats of the attachments instead */
+    VkPipelineRenderingCreateInfo renderingInfo {};
+    renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+    renderingInfo.colorAttachmentCount = 1;
+    renderingInfo.pColorAttachmentFormats = &swapChainImageFormat;
+    if (useDynamicRendering) pipelineInfo.pNext = &renderingInfo;
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; /* Can create pipeline from existing one */
     pipelineInfo.basePipelineIndex = -1;
 
+    VkPipeline pipeline;
     if (vkCreateGraphicsPipelines(
-                logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline)
+                logicalDevice, pipelineCache, 1, &pipelineInfo, pipelineCallbacks, &pipeline)
             != VK_SUCCESS)
         throw std::runtime_error("Failed to create graphics pipeline.");
 
-    /* Can destroy these once the graphics pipeline is built */
-    vkDestroyShaderModule(logicalDevice, vertShaderModule, nullptr);
-    vkDestroyShaderModule(logicalDevice, fragShaderModule, nullptr);
+    return pipeline;
 }
 
 VkShaderModule
-HelloTriangleApplication::createShaderModule(const std::vector<char>& shaderBuf) {
+HelloTriangleApplication::createShaderModule(const ShaderBinary& shader) {
     VkShaderModuleCreateInfo createInfo {};
     createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    createInfo.codeSize = shaderBuf.size();
-    /* Reinterpret bytes in buffer as uint32; buffer must satisfy alignment requirements
-     * but std::vector ensures this by default */
-    createInfo.pCode = reinterpret_cast<const uint32_t *>(shaderBuf.data());
+    createInfo.codeSize = shader.getSize();
+    createInfo.pCode = shader.getCode(); /* Already aligned to 4 bytes, as Vulkan requires */
 
     VkShaderModule shaderModule;
-    if (vkCreateShaderModule(logicalDevice, &createInfo, nullptr, &shaderModule) != VK_SUCCESS)
+    if (vkCreateShaderModule(logicalDevice, &createInfo, pipelineCallbacks, &shaderModule)
+            != VK_SUCCESS)
         throw std::runtime_error("Failed to create shader module.");
 
     return shaderModule;
@@ -690,30 +1707,33 @@ HelloTriangleApplication::createShaderModule(const std::vector<char>& shaderBuf)
 
 void
 HelloTriangleApplication::createFramebuffers() {
+    if (useDynamicRendering) return;
+
     swapChainFramebuffers.resize(swapChainImageViews.size());
     for (size_t i = 0; i < swapChainImageViews.size(); ++i) {
-        VkImageView attachments[] = { swapChainImageViews[i] };
+        /* Multisampled rendering resolves into the image */
+        std::vector<VkImageView> attachments = { swapChainImageViews[i] };
+        if (colorImageView != VK_NULL_HANDLE)
+            attachments.insert(attachments.begin(), colorImageView);
 
         /* Set up framebuffer */
         VkFramebufferCreateInfo framebufferInfo {};
         framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
         framebufferInfo.renderPass = renderPass;
-        framebufferInfo.attachmentCount = 1;
-        framebufferInfo.pAttachments = attachments;
+        framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+        framebufferInfo.pAttachments = attachments.data();
         framebufferInfo.width = swapChainExtent.width;
         framebufferInfo.height = swapChainExtent.height;
         framebufferInfo.layers = 1;
 
-        if (vkCreateFramebuffer(logicalDevice, &framebufferInfo, nullptr, &swapChainFramebuffers[i])
-                != VK_SUCCESS)
+        if (vkCreateFramebuffer(logicalDevice, &framebufferInfo, deviceCallbacks,
+                                &swapChainFramebuffers[i]) != VK_SUCCESS)
             throw std::runtime_error("Failed to create framebuffer.");
     }
 }
 
 void
 HelloTriangleApplication::createCommandPool() {
-    QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
-
     /* Set up command pool */
     VkCommandPoolCreateInfo poolInfo {};
     poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
@@ -721,132 +1741,1589 @@ HelloTriangleApplication::createCommandPool() {
     poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
     poolInfo.flags = 0; /* Can be used to allocate memory based on command frequency */
 
-    if (vkCreateCommandPool(logicalDevice, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+    if (vkCreateCommandPool(logicalDevice, &poolInfo, commandPoolCallbacks, &commandPool)
+            != VK_SUCCESS)
         throw std::runtime_error("Failed to create command pool.");
+
+    /* Command pools can't be used from several threads at once, so each thread gets its own */
+    recordCommandPools.resize(jobSystem->getThreadCount());
+    for (auto& pool : recordCommandPools)
+        if (vkCreateCommandPool(logicalDevice, &poolInfo, commandPoolCallbacks, &pool)
+                != VK_SUCCESS)
+            throw std::runtime_error("Failed to create command pool.");
 }
 
 void
-HelloTriangleApplication::createCommandBuffers() {
-    /* Need one command buffer per framebuffer */
-    commandBuffers.resize(swapChainFramebuffers.size());
+HelloTriangleApplication::createGeometryBuffers() {
+    createDeviceLocalBuffer(MESH_VERTICES.data(), sizeof(MESH_VERTICES),
+            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBuffer, vertexBufferMemory);
+    createDeviceLocalBuffer(MESH_INDICES.data(), sizeof(MESH_INDICES),
+            VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indexBuffer, indexBufferMemory);
+
+    /* Lay the instances out on a square grid covering the screen, one per cell; a single
+     * instance covers the screen just like the original triangle */
+    uint32_t instanceCount = std::max<uint32_t>(config.instanceCount, 1);
+    uint32_t gridSize = static_cast<uint32_t>(std::ceil(std::sqrt(double(instanceCount))));
+    float cellSize = 2.f / gridSize;
+
+    std::vector<InstanceData> instances(instanceCount);
+    for (uint32_t i = 0; i < instanceCount; ++i) {
+        instances[i].offset[0] = -1.f + cellSize * ((i % gridSize) + 0.5f);
+        instances[i].offset[1] = -1.f + cellSize * ((i / gridSize) + 0.5f);
+        instances[i].scale = 1.f / gridSize;
+    }
 
-    /* Set up command buffer allocation */
-    VkCommandBufferAllocateInfo allocInfo {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.commandPool = commandPool;
-    /* If secondary, commands can be called from other primary command buffers */
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandBufferCount = (uint32_t) commandBuffers.size();
+    /* Culling on the GPU reads the instances too */
+    VkBufferUsageFlags instanceUsage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    if (useGpuCulling) instanceUsage |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    createDeviceLocalBuffer(instances.data(), instances.size() * sizeof(InstanceData),
+            instanceUsage, instanceBuffer, instanceBufferMemory);
 
-    /* Allocate command buffers */
-    if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, commandBuffers.data())
-            != VK_SUCCESS)
-        throw std::runtime_error("Failed to allocate command buffers.");
+    /* Start copying right away; the first frame waits for the copies, setup doesn't */
+    flushUploads();
+}
 
-    /* Populate command buffers for each framebuffer */
-    for (size_t i = 0; i < commandBuffers.size(); ++i) {
-        /* Start recording command buffer */
-        VkCommandBufferBeginInfo beginInfo {};
-        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        beginInfo.flags = 0; /* Can be used to control buffer rerecording/resubmitting */
-        beginInfo.pInheritanceInfo = nullptr; /* Only relevant in secondary buffers */
+void
+HelloTriangleApplication::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+        VkMemoryPropertyFlags properties, VkBuffer& buffer, DeviceAllocation& memory,
+        std::vector<uint32_t> queueFamilies) {
+    VkBufferCreateInfo bufferInfo {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    /* Concurrent sharing spares ownership transfers between families that use it every frame */
+    std::sort(queueFamilies.begin(), queueFamilies.end());
+    queueFamilies.erase(std::unique(queueFamilies.begin(), queueFamilies.end()),
+            queueFamilies.end());
+    if (queueFamilies.size() > 1) {
+        bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        bufferInfo.queueFamilyIndexCount = static_cast<uint32_t>(queueFamilies.size());
+        bufferInfo.pQueueFamilyIndices = queueFamilies.data();
+    }
 
-        if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) != VK_SUCCESS)
-            throw std::runtime_error("Failed to begin recording command buffer.");
+    if (vkCreateBuffer(logicalDevice, &bufferInfo, deviceCallbacks, &buffer) != VK_SUCCESS)
+        throw std::runtime_error("Failed to create buffer.");
 
-        /* (The following functions prefixed with vkCmd return void, so no error handling) */
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(logicalDevice, buffer, &memRequirements);
 
-        /* Start a render pass */
-        VkRenderPassBeginInfo renderPassInfo {};
-        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        renderPassInfo.renderPass = renderPass;
-        renderPassInfo.framebuffer = swapChainFramebuffers[i];
-        renderPassInfo.renderArea.offset = { 0, 0 };
-        renderPassInfo.renderArea.extent = swapChainExtent;
-        VkClearValue clearColor = {{{ 0.f, 0.f, 0.f, 1.f }}}; /* The color to use on clear */
-        renderPassInfo.clearValueCount = 1;
-        renderPassInfo.pClearValues = &clearColor;
+    memory = deviceAllocator->allocate(memRequirements, properties);
+    vkBindBufferMemory(logicalDevice, buffer, memory.memory, memory.offset);
+}
 
-        vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+void
+HelloTriangleApplication::createDeviceLocalBuffer(const void *data, VkDeviceSize size,
+        VkBufferUsageFlags usage, VkBuffer& buffer, DeviceAllocation& memory) {
+    /* Device-local memory usually can't be written by the host, so copy the data over */
+    createBuffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, memory);
+
+    VkPipelineStageFlags dstStage = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+    VkAccessFlags dstAccess = 0;
+    if (usage & VK_BUFFER_USAGE_VERTEX_BUFFER_BIT) dstAccess |= VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+    if (usage & VK_BUFFER_USAGE_INDEX_BUFFER_BIT) dstAccess |= VK_ACCESS_INDEX_READ_BIT;
+    if (usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT) {
+        dstStage |= VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        dstAccess |= VK_ACCESS_SHADER_READ_BIT;
+    }
 
-        /* Bind graphics pipeline to command buffer */
-        vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+    queueUpload(buffer, 0, data, size, dstStage, dstAccess);
+}
 
-        /* Draw 3 vertices with no offset in vertex buffer */
-        vkCmdDraw(commandBuffers[i], 3, 1, 0, 0);
+void
+HelloTriangleApplication::createUploadResources() {
+    /* Transfer command buffers are recorded once and thrown away */
+    VkCommandPoolCreateInfo poolInfo {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = transferFamily;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
 
-        /* Finish render pass */
-        vkCmdEndRenderPass(commandBuffers[i]);
+    if (vkCreateCommandPool(logicalDevice, &poolInfo, commandPoolCallbacks, &transferCommandPool)
+            != VK_SUCCESS)
+        throw std::runtime_error("Failed to create transfer command pool.");
 
-        /* Stop recording the command buffer */
-        if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS)
-            throw std::runtime_error("Failed to record command buffer.");
-    }
+    stagingRing = std::make_unique<StagingRing>(logicalDevice, *deviceAllocator,
+            STAGING_RING_SIZE, deviceCallbacks);
+}
+
+void
+HelloTriangleApplication::queueUpload(VkBuffer buffer, VkDeviceSize offset, const void *data,
+        VkDeviceSize size, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) {
+    /* Large uploads go in pieces, so a single one can't hog the whole ring */
+    const VkDeviceSize pieceSize = stagingRing->getSize() / 4;
+
+    for (VkDeviceSize done = 0; done < size; ) {
+        VkDeviceSize length = std::min(pieceSize, size - done);
+
+        VkDeviceSize stagingOffset;
+        void *staging;
+        while (!stagingRing->allocate(length, 16, stagingOffset, staging))
+            waitForStagingSpace();
+
+        std::memcpy(staging, static_cast<const char*>(data) + done, static_cast<size_t>(length));
+
+        PendingUpload upload {};
+        upload.buffer = buffer;
+        upload.region.srcOffset = stagingOffset;
+        upload.region.dstOffset = offset + done;
+        upload.region.size = length;
+        upload.dstStage = dstStage;
+        upload.dstAccess = dstAccess;
+        pendingUploads.push_back(upload);
+
+        done += length;
+    }
+}
+
+void
+HelloTriangleApplication::flushUploads() {
+    if (pendingUploads.empty()) return;
+
+    UploadBatch batch {};
+
+    VkCommandBufferAllocateInfo allocInfo {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = transferCommandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+
+    if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, &batch.transferCommands)
+            != VK_SUCCESS)
+        throw std::runtime_error("Failed to allocate transfer command buffer.");
+
+    VkCommandBufferBeginInfo beginInfo {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(batch.transferCommands, &beginInfo);
+
+    for (const auto& upload : pendingUploads) {
+        vkCmdCopyBuffer(batch.transferCommands, stagingRing->getBuffer(), upload.buffer,
+                1, &upload.region);
+        batch.dstStages |= upload.dstStage;
+    }
+
+    /* Buffers are exclusive to one queue family, so a dedicated transfer family has to hand
+     * them over: released here, and acquired by graphics once the semaphore is signaled.
+     * Within a single family the semaphore alone makes the copies visible */
+    if (transferFamily != graphicsFamily) {
+        std::vector<VkBufferMemoryBarrier> barriers(pendingUploads.size());
+        for (size_t i = 0; i < pendingUploads.size(); ++i) {
+            barriers[i].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            barriers[i].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barriers[i].dstAccessMask = 0;
+            barriers[i].srcQueueFamilyIndex = transferFamily;
+            barriers[i].dstQueueFamilyIndex = graphicsFamily;
+            barriers[i].buffer = pendingUploads[i].buffer;
+            barriers[i].offset = pendingUploads[i].region.dstOffset;
+            barriers[i].size = pendingUploads[i].region.size;
+        }
+        vkCmdPipelineBarrier(batch.transferCommands, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+                static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+
+        allocInfo.commandPool = commandPool;
+        if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, &batch.acquireCommands)
+                != VK_SUCCESS)
+            throw std::runtime_error("Failed to allocate acquire command buffer.");
+
+        vkBeginCommandBuffer(batch.acquireCommands, &beginInfo);
+        for (size_t i = 0; i < pendingUploads.size(); ++i) {
+            barriers[i].srcAccessMask = 0;
+            barriers[i].dstAccessMask = pendingUploads[i].dstAccess;
+        }
+        vkCmdPipelineBarrier(batch.acquireCommands, batch.dstStages, batch.dstStages, 0,
+                0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+        vkEndCommandBuffer(batch.acquireCommands);
+    }
+
+    vkEndCommandBuffer(batch.transferCommands);
+
+    VkSemaphoreCreateInfo semaphoreInfo {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    VkFenceCreateInfo fenceInfo {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    if (vkCreateSemaphore(logicalDevice, &semaphoreInfo, deviceCallbacks, &batch.semaphore)
+            != VK_SUCCESS ||
+            vkCreateFence(logicalDevice, &fenceInfo, deviceCallbacks, &batch.fence) != VK_SUCCESS)
+        throw std::runtime_error("Failed to create upload synchronization objects.");
+
+    VkSubmitInfo submitInfo {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &batch.transferCommands;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &batch.semaphore;
+
+    if (vkQueueSubmit(transferQueue, 1, &submitInfo, batch.fence) != VK_SUCCESS)
+        throw std::runtime_error("Failed to submit uploads.");
+
+    batch.ringPosition = stagingRing->getHead();
+    uploadBatches.push_back(batch);
+    pendingUploads.clear();
+}
+
+void
+HelloTriangleApplication::waitForStagingSpace() {
+    /* Whatever is staged but not submitted can't be waited for, so submit it first */
+    flushUploads();
+
+    for (auto& batch : uploadBatches)
+        if (!batch.ringReleased) {
+            vkWaitForFences(logicalDevice, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+            stagingRing->release(batch.ringPosition);
+            batch.ringReleased = true;
+            return;
+        }
+
+    throw std::runtime_error("Failed to find staging space for upload.");
+}
+
+void
+HelloTriangleApplication::releaseUploadBatches(bool releaseAll) {
+    auto it = uploadBatches.begin();
+    while (it != uploadBatches.end()) {
+        /* Staging space is free as soon as the copies are done */
+        if (!it->ringReleased &&
+                (releaseAll || vkGetFenceStatus(logicalDevice, it->fence) == VK_SUCCESS)) {
+            stagingRing->release(it->ringPosition);
+            it->ringReleased = true;
+        }
+
+        /* The rest has to wait for the frame that waited on the semaphore */
+        bool frameDone = it->frameCount != 0 && completedFrameCount >= it->frameCount;
+        if (!releaseAll && !(it->ringReleased && frameDone)) {
+            ++it;
+            continue;
+        }
+
+        vkFreeCommandBuffers(logicalDevice, transferCommandPool, 1, &it->transferCommands);
+        if (it->acquireCommands != VK_NULL_HANDLE)
+            vkFreeCommandBuffers(logicalDevice, commandPool, 1, &it->acquireCommands);
+        vkDestroySemaphore(logicalDevice, it->semaphore, deviceCallbacks);
+        vkDestroyFence(logicalDevice, it->fence, deviceCallbacks);
+
+        it = uploadBatches.erase(it);
+    }
+}
+
+void
+HelloTriangleApplication::createCaptureResources() {
+    if (swapChainImageFormat != VK_FORMAT_R8G8B8A8_UNORM &&
+            swapChainImageFormat != VK_FORMAT_R8G8B8A8_SRGB &&
+            swapChainImageFormat != VK_FORMAT_B8G8R8A8_UNORM &&
+            swapChainImageFormat != VK_FORMAT_B8G8R8A8_SRGB)
+        throw std::runtime_error("Failed to capture frames: unsupported image format.");
+
+    frameCapture = std::make_unique<FrameCapture>(config.captureDir, config.goldenDir,
+                                                  config.goldenTolerance);
+
+    /* The copies are read on the host, where cached memory is much faster to read from */
+    VkMemoryPropertyFlags cached = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT |
+                                   VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    captureMemoryProperties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                              VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    for (uint32_t i = 0; i < deviceInfo.memoryProperties.memoryTypeCount; ++i)
+        if ((deviceInfo.memoryProperties.memoryTypes[i].propertyFlags & cached) == cached) {
+            captureMemoryProperties = cached;
+            break;
+        }
+
+    VkCommandPoolCreateInfo poolInfo {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = graphicsFamily;
+    /* Each buffer is recorded anew for every capture */
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+                     VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    if (vkCreateCommandPool(logicalDevice, &poolInfo, commandPoolCallbacks, &captureCommandPool)
+            != VK_SUCCESS)
+        throw std::runtime_error("Failed to create capture command pool.");
+
+    /* A frame's slot is free again once the frame completes, which it has by the time the
+     * slot comes around again; buffers are created on first use, at the size of the image */
+    size_t slotCount = std::max(config.framesInFlight, MAX_PROFILE_FRAMES_IN_FLIGHT);
+    captureSlots.resize(slotCount + 1);
+    std::vector<VkCommandBuffer> commands(captureSlots.size());
+
+    VkCommandBufferAllocateInfo allocInfo {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = captureCommandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = static_cast<uint32_t>(commands.size());
+    if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, commands.data()) != VK_SUCCESS)
+        throw std::runtime_error("Failed to allocate capture command buffers.");
+
+    for (size_t i = 0; i < captureSlots.size(); ++i)
+        captureSlots[i].commands = commands[i];
+}
+
+void
+HelloTriangleApplication::createCaptureBuffer(CaptureSlot& slot, VkDeviceSize size) {
+    if (slot.buffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(logicalDevice, slot.buffer, deviceCallbacks);
+        deviceAllocator->free(slot.memory);
+    }
+
+    createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, captureMemoryProperties, slot.buffer,
+                 slot.memory);
+    slot.size = size;
+}
+
+VkCommandBuffer
+HelloTriangleApplication::recordCapture(uint32_t imageIndex) {
+    if (!frameCapture || frameNumber % std::max(config.captureInterval, 1u) != 0)
+        return VK_NULL_HANDLE;
+
+    /* Never wait for a buffer; if the ring is still full, the frame goes uncaptured */
+    CaptureSlot& slot = captureSlots[nextCaptureSlot];
+    if (slot.frameCount != 0) {
+        frameCapture->drop();
+        return VK_NULL_HANDLE;
+    }
+    nextCaptureSlot = (nextCaptureSlot + 1) % captureSlots.size();
+
+    /* Four bytes per pixel, rows tightly packed */
+    VkDeviceSize size = VkDeviceSize(swapChainExtent.width) * swapChainExtent.height * 4;
+    if (slot.size < size) createCaptureBuffer(slot, size);
+
+    VkCommandBufferBeginInfo beginInfo {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if (vkBeginCommandBuffer(slot.commands, &beginInfo) != VK_SUCCESS)
+        throw std::runtime_error("Failed to begin recording capture command buffer.");
+
+    /* Drawing left the image ready to present (or to copy, when headless); its writes are
+     * made available to transfers by the render pass's outgoing dependency, or by the barrier
+     * ending dynamic rendering */
+    VkImageLayout drawnLayout = config.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                                : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    VkImageMemoryBarrier imageBarrier {};
+    imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    imageBarrier.srcAccessMask = 0;
+    imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    imageBarrier.oldLayout = drawnLayout;
+    imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.image = swapChainImages[imageIndex];
+    imageBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+    if (!config.headless)
+        vkCmdPipelineBarrier(slot.commands, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+
+    VkBufferImageCopy region {};
+    region.bufferOffset = 0;
+    region.bufferRowLength = 0; /* Tightly packed */
+    region.bufferImageHeight = 0;
+    region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+    region.imageOffset = { 0, 0, 0 };
+    region.imageExtent = { swapChainExtent.width, swapChainExtent.height, 1 };
+    vkCmdCopyImageToBuffer(slot.commands, swapChainImages[imageIndex],
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot.buffer, 1, &region);
+
+    /* Make the copy visible to the host once it has waited for the frame, and hand the image
+     * back for presentation */
+    VkBufferMemoryBarrier bufferBarrier {};
+    bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bufferBarrier.buffer = slot.buffer;
+    bufferBarrier.offset = 0;
+    bufferBarrier.size = size;
+
+    imageBarrier.srcAccessMask = 0;
+    imageBarrier.dstAccessMask = 0;
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    imageBarrier.newLayout = drawnLayout;
+    vkCmdPipelineBarrier(slot.commands, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+            1, &bufferBarrier, config.headless ? 0 : 1, &imageBarrier);
+
+    if (vkEndCommandBuffer(slot.commands) != VK_SUCCESS)
+        throw std::runtime_error("Failed to record capture command buffer.");
+
+    slot.frameCount = frameNumber + 1;
+    slot.frame.frame = frameNumber;
+    slot.frame.width = swapChainExtent.width;
+    slot.frame.height = swapChainExtent.height;
+    slot.frame.bgra = swapChainImageFormat == VK_FORMAT_B8G8R8A8_UNORM ||
+                      swapChainImageFormat == VK_FORMAT_B8G8R8A8_SRGB;
+
+    return slot.commands;
+}
+
+void
+HelloTriangleApplication::collectCaptures(bool collectAll) {
+    /* Polls rather than waits: a frame still running is picked up by a later call */
+    uint64_t completed = collectAll ? UINT64_MAX : getCompletedFrameCount();
+
+    /* Oldest first, so frames reach the capture thread in order */
+    for (size_t i = 0; i < captureSlots.size(); ++i) {
+        CaptureSlot& slot = captureSlots[(nextCaptureSlot + i) % captureSlots.size()];
+        if (slot.frameCount == 0 || slot.frameCount > completed) continue;
+
+        /* Copy the pixels out so the buffer can take the next frame right away */
+        CapturedFrame frame = slot.frame;
+        auto pixels = static_cast<const uint8_t *>(slot.memory.mapped);
+        frame.pixels.assign(pixels, pixels + size_t(frame.width) * frame.height * 4);
+        frameCapture->submit(std::move(frame));
+
+        slot.frameCount = 0;
+    }
+}
+
+void
+HelloTriangleApplication::createComputePipeline() {
+    /* The shader writes the instances through a single storage buffer */
+    VkDescriptorSetLayoutBinding binding {};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    binding.descriptorCount = 1;
+    binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkDescriptorSetLayoutCreateInfo setLayoutInfo {};
+    setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    setLayoutInfo.bindingCount = 1;
+    setLayoutInfo.pBindings = &binding;
+
+    if (vkCreateDescriptorSetLayout(logicalDevice, &setLayoutInfo, deviceCallbacks,
+                &computeDescriptorSetLayout) != VK_SUCCESS)
+        throw std::runtime_error("Failed to create compute descriptor set layout.");
+
+    VkPushConstantRange pushConstants {};
+    pushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstants.offset = 0;
+    pushConstants.size = sizeof(AnimationParams);
+
+    VkPipelineLayoutCreateInfo layoutInfo {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &computeDescriptorSetLayout;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushConstants;
+
+    if (vkCreatePipelineLayout(
+            logicalDevice, &layoutInfo, pipelineCallbacks, &computePipelineLayout) != VK_SUCCESS)
+        throw std::runtime_error("Failed to create compute pipeline layout.");
+
+    VkShaderModule compShaderModule = createShaderModule(compShaderCode);
+
+    VkComputePipelineCreateInfo pipelineInfo {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = compShaderModule;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = computePipelineLayout;
+
+    VkResult result = vkCreateComputePipelines(logicalDevice, pipelineCache, 1, &pipelineInfo,
+            pipelineCallbacks, &computePipeline);
+    vkDestroyShaderModule(logicalDevice, compShaderModule, pipelineCallbacks);
+    if (result != VK_SUCCESS)
+        throw std::runtime_error("Failed to create compute pipeline.");
+
+    /* Sets are allocated anew whenever the swap chain changes, and the old ones are freed
+     * when it retires; only a few swap chains are ever retired at once */
+    VkDescriptorPoolSize poolSize {};
+    poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSize.descriptorCount = 8;
+
+    VkDescriptorPoolCreateInfo poolInfo {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+    poolInfo.maxSets = 8;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+
+    if (vkCreateDescriptorPool(logicalDevice, &poolInfo, deviceCallbacks, &computeDescriptorPool)
+            != VK_SUCCESS)
+        throw std::runtime_error("Failed to create compute descriptor pool.");
+
+    /* The compute work is recorded anew each frame, into one command buffer per slot */
+    VkCommandPoolCreateInfo commandPoolInfo {};
+    commandPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    commandPoolInfo.queueFamilyIndex = computeFamily;
+    commandPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+                            VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+    if (vkCreateCommandPool(
+            logicalDevice, &commandPoolInfo, commandPoolCallbacks, &computeCommandPool)
+            != VK_SUCCESS)
+        throw std::runtime_error("Failed to create compute command pool.");
+
+    size_t slotCount = std::max(config.framesInFlight, MAX_PROFILE_FRAMES_IN_FLIGHT);
+    computeCommandBuffers.resize(slotCount);
+
+    VkCommandBufferAllocateInfo allocInfo {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = computeCommandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = static_cast<uint32_t>(slotCount);
+
+    if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, computeCommandBuffers.data())
+            != VK_SUCCESS)
+        throw std::runtime_error("Failed to allocate compute command buffers.");
+
+    VkSemaphoreCreateInfo semaphoreInfo {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    computeFinishedSemaphores.resize(slotCount);
+    for (auto& semaphore : computeFinishedSemaphores)
+        if (vkCreateSemaphore(logicalDevice, &semaphoreInfo, deviceCallbacks, &semaphore)
+                != VK_SUCCESS)
+            throw std::runtime_error("Failed to create compute semaphore.");
+
+    animationStart = std::chrono::steady_clock::now();
+}
+
+void
+HelloTriangleApplication::createAnimatedInstanceBuffer() {
+    /* Compute writes it and graphics reads it every frame, possibly from different families */
+    VkDeviceSize size = VkDeviceSize(swapChainImages.size()) * config.instanceCount *
+                        sizeof(InstanceData);
+    createBuffer(size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, animatedInstanceBuffer, animatedInstanceMemory,
+            { graphicsFamily, computeFamily });
+
+    VkDescriptorSetAllocateInfo allocInfo {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = computeDescriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &computeDescriptorSetLayout;
+
+    if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, &computeDescriptorSet) != VK_SUCCESS)
+        throw std::runtime_error("Failed to allocate compute descriptor set.");
+
+    VkDescriptorBufferInfo bufferInfo {};
+    bufferInfo.buffer = animatedInstanceBuffer;
+    bufferInfo.offset = 0;
+    bufferInfo.range = VK_WHOLE_SIZE;
+
+    VkWriteDescriptorSet write {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = computeDescriptorSet;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &bufferInfo;
+    vkUpdateDescriptorSets(logicalDevice, 1, &write, 0, nullptr);
+}
+
+void
+HelloTriangleApplication::submitInstanceAnimation(uint32_t imageIndex) {
+    VkCommandBuffer commandBuffer = computeCommandBuffers[currentFrame];
+    vkResetCommandBuffer(commandBuffer, 0);
+
+    VkCommandBufferBeginInfo beginInfo {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+        throw std::runtime_error("Failed to begin recording compute command buffer.");
+
+    AnimationParams params {};
+    params.firstInstance = imageIndex * config.instanceCount;
+    params.count = config.instanceCount;
+    params.gridSize = static_cast<uint32_t>(std::ceil(std::sqrt(double(config.instanceCount))));
+    params.time = static_cast<float>(millisecondsSince(animationStart) / 1000.0);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout,
+            0, 1, &computeDescriptorSet, 0, nullptr);
+    vkCmdPushConstants(commandBuffer, computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+            sizeof(params), &params);
+    /* 256 invocations per workgroup, as declared in the shader */
+    vkCmdDispatch(commandBuffer, (config.instanceCount + 255) / 256, 1, 1);
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+        throw std::runtime_error("Failed to record compute command buffer.");
+
+    /* The graphics submission of this frame waits on the semaphore before reading vertices */
+    VkSubmitInfo submitInfo {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &computeFinishedSemaphores[currentFrame];
+
+    if (vkQueueSubmit(computeQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+        throw std::runtime_error("Failed to submit compute command buffer.");
+}
+
+void
+HelloTriangleApplication::createCullPipeline() {
+    /* The device may not be able to draw from the culling results */
+    if (!useGpuCulling) return;
+
+    /* Instances in, draws and their count out */
+    std::array<VkDescriptorSetLayoutBinding, 3> bindings {};
+    for (uint32_t i = 0; i < bindings.size(); ++i) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo setLayoutInfo {};
+    setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    setLayoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    setLayoutInfo.pBindings = bindings.data();
+
+    if (vkCreateDescriptorSetLayout(logicalDevice, &setLayoutInfo, deviceCallbacks,
+                &cullDescriptorSetLayout) != VK_SUCCESS)
+        throw std::runtime_error("Failed to create culling descriptor set layout.");
+
+    VkPushConstantRange pushConstants {};
+    pushConstants.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstants.offset = 0;
+    pushConstants.size = sizeof(CullParams);
+
+    VkPipelineLayoutCreateInfo layoutInfo {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    layoutInfo.setLayoutCount = 1;
+    layoutInfo.pSetLayouts = &cullDescriptorSetLayout;
+    layoutInfo.pushConstantRangeCount = 1;
+    layoutInfo.pPushConstantRanges = &pushConstants;
+
+    if (vkCreatePipelineLayout(logicalDevice, &layoutInfo, pipelineCallbacks, &cullPipelineLayout)
+            != VK_SUCCESS)
+        throw std::runtime_error("Failed to create culling pipeline layout.");
+
+    VkShaderModule cullShaderModule = createShaderModule(cullShaderCode);
+
+    VkComputePipelineCreateInfo pipelineInfo {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = cullShaderModule;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = cullPipelineLayout;
+
+    VkResult result = vkCreateComputePipelines(logicalDevice, pipelineCache, 1, &pipelineInfo,
+            pipelineCallbacks, &cullPipeline);
+    vkDestroyShaderModule(logicalDevice, cullShaderModule, pipelineCallbacks);
+    if (result != VK_SUCCESS)
+        throw std::runtime_error("Failed to create culling pipeline.");
+
+    /* As for the animation, sets are replaced along with the swap chain; when re-recording,
+     * every in-flight slot has a set of its own instead */
+    uint32_t maxSets = 8;
+    if (config.rerecordCommandBuffers)
+        maxSets = static_cast<uint32_t>(std::max(config.framesInFlight,
+                                                 MAX_PROFILE_FRAMES_IN_FLIGHT));
+
+    VkDescriptorPoolSize poolSize {};
+    poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSize.descriptorCount = maxSets * static_cast<uint32_t>(bindings.size());
+
+    VkDescriptorPoolCreateInfo poolInfo {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+    poolInfo.maxSets = maxSets;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+
+    if (vkCreateDescriptorPool(logicalDevice, &poolInfo, deviceCallbacks, &cullDescriptorPool)
+            != VK_SUCCESS)
+        throw std::runtime_error("Failed to create culling descriptor pool.");
+}
+
+void
+HelloTriangleApplication::createIndirectBuffers() {
+    /* Re-recorded frames take theirs from the frame arenas */
+    if (!useGpuCulling || config.rerecordCommandBuffers) return;
+
+    /* Room for every instance to survive, for every image; written and read on the graphics
+     * queue only */
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                               VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                               VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    VkDeviceSize imageCount = swapChainImages.size();
+    createBuffer(imageCount * config.instanceCount * sizeof(VkDrawIndexedIndirectCommand), usage,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indirectBuffer, indirectMemory);
+    createBuffer(imageCount * sizeof(uint32_t), usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            drawCountBuffer, drawCountMemory);
+
+    VkDescriptorSetAllocateInfo allocInfo {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = cullDescriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &cullDescriptorSetLayout;
+
+    if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, &cullDescriptorSet) != VK_SUCCESS)
+        throw std::runtime_error("Failed to allocate culling descriptor set.");
+
+    std::array<VkDescriptorBufferInfo, 3> bufferInfos {};
+    bufferInfos[0].buffer = config.animateInstances ? animatedInstanceBuffer : instanceBuffer;
+    bufferInfos[1].buffer = indirectBuffer;
+    bufferInfos[2].buffer = drawCountBuffer;
+    for (auto& bufferInfo : bufferInfos) bufferInfo.range = VK_WHOLE_SIZE;
+    writeCullDescriptorSet(cullDescriptorSet, bufferInfos);
+}
+
+void
+HelloTriangleApplication::createFrameArenas() {
+    if (!useGpuCulling) return;
+
+    /* Room for every instance to survive, plus the padding the descriptor offsets need */
+    VkDeviceSize alignment = std::max<VkDeviceSize>(sizeof(uint32_t),
+            deviceInfo.properties.limits.minStorageBufferOffsetAlignment);
+    VkDeviceSize size = VkDeviceSize(config.instanceCount) * sizeof(VkDrawIndexedIndirectCommand) +
+                        2 * alignment + sizeof(uint32_t);
+
+    VkBufferCreateInfo bufferInfo {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                       VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    frameArenas.resize(std::max(config.framesInFlight, MAX_PROFILE_FRAMES_IN_FLIGHT));
+    for (auto& frame : frameArenas) {
+        if (vkCreateBuffer(logicalDevice, &bufferInfo, deviceCallbacks, &frame.buffer)
+                != VK_SUCCESS)
+            throw std::runtime_error("Failed to create frame arena buffer.");
+
+        /* One buffer over the whole arena, so allocating from it needs no Vulkan calls */
+        VkMemoryRequirements memRequirements;
+        vkGetBufferMemoryRequirements(logicalDevice, frame.buffer, &memRequirements);
+        frame.arena = deviceAllocator->createArena(memRequirements.size,
+                memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        DeviceAllocation memory = deviceAllocator->getArenaMemory(frame.arena);
+        if (vkBindBufferMemory(logicalDevice, frame.buffer, memory.memory, 0) != VK_SUCCESS)
+            throw std::runtime_error("Failed to bind frame arena buffer memory.");
+
+        VkDescriptorSetAllocateInfo allocInfo {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = cullDescriptorPool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &cullDescriptorSetLayout;
+
+        if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, &frame.cullDescriptorSet)
+                != VK_SUCCESS)
+            throw std::runtime_error("Failed to allocate frame culling descriptor set.");
+    }
+}
+
+void
+HelloTriangleApplication::resetFrameArena() {
+    FrameArena& frame = frameArenas[currentFrame];
+    VkMemoryRequirements requirements {};
+    requirements.alignment = std::max<VkDeviceSize>(sizeof(uint32_t),
+            deviceInfo.properties.limits.minStorageBufferOffsetAlignment);
+    requirements.memoryTypeBits = ~0u;
+
+    /* The slot's last frame has completed, so nothing reads what it left behind */
+    deviceAllocator->resetArena(frame.arena);
+    requirements.size = VkDeviceSize(config.instanceCount) * sizeof(VkDrawIndexedIndirectCommand);
+    frame.commands = deviceAllocator->allocateLinear(frame.arena, requirements);
+    requirements.size = sizeof(uint32_t);
+    frame.drawCount = deviceAllocator->allocateLinear(frame.arena, requirements);
+
+    /* Nor does anything use the set, which also picks up the instance buffer of the current
+     * swap chain */
+    std::array<VkDescriptorBufferInfo, 3> bufferInfos {};
+    bufferInfos[0].buffer = config.animateInstances ? animatedInstanceBuffer : instanceBuffer;
+    bufferInfos[0].range = VK_WHOLE_SIZE;
+    bufferInfos[1].buffer = frame.buffer;
+    bufferInfos[1].offset = frame.commands.offset;
+    bufferInfos[1].range = frame.commands.size;
+    bufferInfos[2].buffer = frame.buffer;
+    bufferInfos[2].offset = frame.drawCount.offset;
+    bufferInfos[2].range = frame.drawCount.size;
+    writeCullDescriptorSet(frame.cullDescriptorSet, bufferInfos);
+}
+
+void
+HelloTriangleApplication::writeCullDescriptorSet(VkDescriptorSet descriptorSet,
+        const std::array<VkDescriptorBufferInfo, 3>& buffers) {
+    std::array<VkWriteDescriptorSet, 3> writes {};
+    for (uint32_t i = 0; i < writes.size(); ++i) {
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = descriptorSet;
+        writes[i].dstBinding = i;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[i].pBufferInfo = &buffers[i];
+    }
+    vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(writes.size()), writes.data(),
+            0, nullptr);
+}
+
+HelloTriangleApplication::IndirectDraws
+HelloTriangleApplication::getIndirectDraws(uint32_t imageIndex) const {
+    IndirectDraws draws {};
+
+    /* A re-recorded frame has its own, at the start of what the descriptors cover */
+    if (!frameArenas.empty()) {
+        const FrameArena& frame = frameArenas[currentFrame];
+        draws.commands = frame.buffer;
+        draws.commandsOffset = frame.commands.offset;
+        draws.count = frame.buffer;
+        draws.countOffset = frame.drawCount.offset;
+        draws.descriptorSet = frame.cullDescriptorSet;
+        return draws;
+    }
+
+    /* Otherwise each image has its part of the shared buffers */
+    draws.commands = indirectBuffer;
+    draws.commandsOffset = VkDeviceSize(imageIndex) * config.instanceCount *
+                           sizeof(VkDrawIndexedIndirectCommand);
+    draws.count = drawCountBuffer;
+    draws.countOffset = imageIndex * sizeof(uint32_t);
+    draws.descriptorSet = cullDescriptorSet;
+    draws.firstCommand = imageIndex * config.instanceCount;
+    draws.countIndex = imageIndex;
+    return draws;
+}
+
+void
+HelloTriangleApplication::recordCulling(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+    IndirectDraws draws = getIndirectDraws(imageIndex);
+
+    /* The last draws from these buffers are done with them (the image's or slot's previous
+     * frame has completed), but make sure they are before overwriting them */
+    VkMemoryBarrier barrier {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    /* Survivors are counted from zero. Without a count buffer to draw with, all the draws
+     * are issued, so those left over must draw nothing (zero instances) */
+    vkCmdFillBuffer(commandBuffer, draws.count, draws.countOffset, sizeof(uint32_t), 0);
+    if (!useDrawIndirectCount)
+        vkCmdFillBuffer(commandBuffer, draws.commands, draws.commandsOffset,
+                config.instanceCount * sizeof(VkDrawIndexedIndirectCommand), 0);
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    /* The mesh fits in a circle as large as its farthest vertex from the origin */
+    float boundingRadius = 0.f;
+    for (const auto& vertex : MESH_VERTICES)
+        boundingRadius = std::max(boundingRadius,
+                std::hypot(vertex.position[0], vertex.position[1]));
+
+    CullParams params {};
+    params.firstObject = config.animateInstances ? imageIndex * config.instanceCount : 0;
+    params.objectCount = config.instanceCount;
+    params.firstCommand = draws.firstCommand;
+    params.countIndex = draws.countIndex;
+    params.indexCount = static_cast<uint32_t>(MESH_INDICES.size());
+    params.boundingRadius = boundingRadius;
+    /* Everything drawn lands in clip space, where the view is [-1, 1] on both axes */
+    params.viewMin[0] = params.viewMin[1] = -1.f;
+    params.viewMax[0] = params.viewMax[1] = 1.f;
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout,
+            0, 1, &draws.descriptorSet, 0, nullptr);
+    vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+            sizeof(params), &params);
+    /* 256 invocations per workgroup, as declared in the shader */
+    vkCmdDispatch(commandBuffer, (config.instanceCount + 255) / 256, 1, 1);
+
+    /* The draws are read as indirect commands from here on */
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+uint32_t
+HelloTriangleApplication::getSliceCount() {
+    /* Large scenes are split into slices recorded into secondary command buffers in parallel,
+     * as many per image as there are threads to record them */
+    return static_cast<uint32_t>(std::max<size_t>(std::min<size_t>(
+            (config.drawCount + MIN_DRAWS_PER_SECONDARY - 1) / MIN_DRAWS_PER_SECONDARY,
+            jobSystem->getThreadCount()), 1));
+}
+
+void
+HelloTriangleApplication::createCommandBuffers() {
+    /* Frames record their own command buffers then */
+    if (config.rerecordCommandBuffers) return;
+
+    /* Need one command buffer per image */
+    commandBuffers.resize(swapChainImages.size());
+
+    /* Set up command buffer allocation */
+    VkCommandBufferAllocateInfo allocInfo {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = commandPool;
+    /* If secondary, commands can be called from other primary command buffers */
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = (uint32_t) commandBuffers.size();
+
+    /* Allocate command buffers */
+    if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, commandBuffers.data())
+            != VK_SUCCESS)
+        throw std::runtime_error("Failed to allocate command buffers.");
+
+    uint32_t sliceCount = getSliceCount();
+    bool useSecondaries = sliceCount > 1;
+
+    if (useSecondaries) {
+        uint32_t sliceSize = (config.drawCount + sliceCount - 1) / sliceCount;
+        secondaryCommandBuffers.assign(commandBuffers.size() * sliceCount, VK_NULL_HANDLE);
+        secondaryCommandPools.assign(secondaryCommandBuffers.size(), VK_NULL_HANDLE);
+
+        /* Each slot is written by exactly one job, and recorded from that job thread's pool */
+        JobCounter counter;
+        for (size_t slot = 0; slot < secondaryCommandBuffers.size(); ++slot)
+            jobSystem->submit(counter, [this, slot, sliceCount, sliceSize](size_t thread) {
+                uint32_t firstDraw = static_cast<uint32_t>(slot % sliceCount) * sliceSize;
+                uint32_t drawCount = std::min(sliceSize, config.drawCount - firstDraw);
+
+                secondaryCommandPools[slot] = recordCommandPools[thread];
+                secondaryCommandBuffers[slot] = recordSecondaryCommandBuffer(
+                        recordCommandPools[thread], static_cast<uint32_t>(slot / sliceCount),
+                        drawCount);
+            });
+        jobSystem->wait(counter);
+    }
+
+    /* Populate command buffers for each image */
+    for (size_t i = 0; i < commandBuffers.size(); ++i)
+        recordCommandBuffer(commandBuffers[i], static_cast<uint32_t>(i),
+                useSecondaries ? &secondaryCommandBuffers[i * sliceCount] : nullptr,
+                sliceCount, 0);
+}
+
+void
+HelloTriangleApplication::recordCommandBuffer(VkCommandBuffer commandBuffer,
+        uint32_t imageIndex, const VkCommandBuffer *secondaries, uint32_t sliceCount,
+        VkCommandBufferUsageFlags flags) {
+    /* Start recording command buffer */
+    VkCommandBufferBeginInfo beginInfo {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = flags; /* Can be used to control buffer rerecording/resubmitting */
+    beginInfo.pInheritanceInfo = nullptr; /* Only relevant in secondary buffers */
+
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+        throw std::runtime_error("Failed to begin recording command buffer.");
+
+    /* (The following functions prefixed with vkCmd return void, so no error handling) */
+
+    /* Bracket the render pass with timestamps (queries must be reset outside of it) */
+    if (timestampQueryPool != VK_NULL_HANDLE) {
+        vkCmdResetQueryPool(commandBuffer, timestampQueryPool, 2 * imageIndex, 2);
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                timestampQueryPool, 2 * imageIndex);
+    }
+
+    /* Decide what to draw before drawing it */
+    if (useGpuCulling) recordCulling(commandBuffer, imageIndex);
+
+    recordBeginRendering(commandBuffer, imageIndex, secondaries != nullptr);
+    if (secondaries != nullptr)
+        /* The draws were recorded by the job system; just run them */
+        vkCmdExecuteCommands(commandBuffer, sliceCount, secondaries);
+    else
+        recordDraws(commandBuffer, imageIndex, config.drawCount);
+    recordEndRendering(commandBuffer, imageIndex);
+
+    if (timestampQueryPool != VK_NULL_HANDLE)
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                timestampQueryPool, 2 * imageIndex + 1);
+
+    /* Stop recording the command buffer */
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+        throw std::runtime_error("Failed to record command buffer.");
+}
+
+void
+HelloTriangleApplication::recordBeginRendering(VkCommandBuffer commandBuffer,
+        uint32_t imageIndex, bool secondaries) {
+    VkClearValue clearColor = {{{ 0.f, 0.f, 0.f, 1.f }}}; /* The color to use on clear */
+
+    if (!useDynamicRendering) {
+        /* Start a render pass */
+        VkRenderPassBeginInfo renderPassInfo {};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = renderPass;
+        renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
+        renderPassInfo.renderArea.offset = { 0, 0 };
+        renderPassInfo.renderArea.extent = swapChainExtent;
+        renderPassInfo.clearValueCount = 1;
+        renderPassInfo.pClearValues = &clearColor;
+
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, secondaries
+                             ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+                             : VK_SUBPASS_CONTENTS_INLINE);
+        return;
+    }
+
+    /* What the render pass's initial layouts and external dependency did: the image may be
+     * drawn to once the semaphore waited on at this stage says it was acquired */
+    VkImageMemoryBarrier2 barriers[2] {};
+    for (auto& barrier : barriers) {
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+        barrier.dstStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+        barrier.dstAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED; /* The previous contents are cleared */
+        barrier.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.levelCount = 1;
+        barrier.subresourceRange.layerCount = 1;
+    }
+    barriers[0].image = swapChainImages[imageIndex];
+    /* The multisampled image is shared by all frames, so the previous frame's writes to it
+     * must be done as well */
+    barriers[1].image = colorImage;
+    barriers[1].srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
+
+    VkDependencyInfo dependencyInfo {};
+    dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependencyInfo.imageMemoryBarrierCount = colorImage != VK_NULL_HANDLE ? 2 : 1;
+    dependencyInfo.pImageMemoryBarriers = barriers;
+    pfnCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+
+    /* When multisampling, the samples are drawn to and resolved into the image at the end,
+     * never stored; otherwise the image is drawn to directly */
+    VkRenderingAttachmentInfo colorAttachment {};
+    colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+    colorAttachment.imageView = swapChainImageViews[imageIndex];
+    colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    colorAttachment.clearValue = clearColor;
+    if (colorImage != VK_NULL_HANDLE) {
+        colorAttachment.resolveMode = VK_RESOLVE_MODE_AVERAGE_BIT;
+        colorAttachment.resolveImageView = colorAttachment.imageView;
+        colorAttachment.resolveImageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        colorAttachment.imageView = colorImageView;
+        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    }
+
+    VkRenderingInfo renderingInfo {};
+    renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+    renderingInfo.flags = secondaries ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0;
+    renderingInfo.renderArea.offset = { 0, 0 };
+    renderingInfo.renderArea.extent = swapChainExtent;
+    renderingInfo.layerCount = 1;
+    renderingInfo.colorAttachmentCount = 1;
+    renderingInfo.pColorAttachments = &colorAttachment;
+    pfnCmdBeginRendering(commandBuffer, &renderingInfo);
+}
+
+void
+HelloTriangleApplication::recordEndRendering(VkCommandBuffer commandBuffer,
+        uint32_t imageIndex) {
+    if (!useDynamicRendering) {
+        vkCmdEndRenderPass(commandBuffer);
+        return;
+    }
+
+    pfnCmdEndRendering(commandBuffer);
+
+    /* Present the image, or keep it ready to be copied out when headless; captured frames
+     * are copied out right away, so the copy has to see what was drawn */
+    VkImageMemoryBarrier2 barrier {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+    barrier.srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
+    if (config.capturesFrames()) {
+        barrier.dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+        barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT;
+    }
+    barrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    barrier.newLayout = config.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                        : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = swapChainImages[imageIndex];
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.layerCount = 1;
+
+    VkDependencyInfo dependencyInfo {};
+    dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    dependencyInfo.imageMemoryBarrierCount = 1;
+    dependencyInfo.pImageMemoryBarriers = &barrier;
+    pfnCmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+}
+
+void
+HelloTriangleApplication::recordDraws(VkCommandBuffer commandBuffer, uint32_t imageIndex,
+        uint32_t drawCount) {
+    /* Bind graphics pipeline to command buffer */
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+
+    /* Set the dynamic state; secondary command buffers don't inherit it, so each sets its own.
+     * Swap chain image dimensions may differ from the window, but are what we render to */
+    VkViewport viewport {};
+    viewport.width = (float) swapChainExtent.width;
+    viewport.height = (float) swapChainExtent.height;
+    viewport.minDepth = 0.f;
+    viewport.maxDepth = 1.f;
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+    VkRect2D scissor {};
+    scissor.offset = { 0, 0 };
+    scissor.extent = swapChainExtent;
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+    if (useExtendedDynamicState) {
+        pfnCmdSetCullMode(commandBuffer, config.pipelineVariant.cullMode);
+        pfnCmdSetFrontFace(commandBuffer, VK_FRONT_FACE_CLOCKWISE);
+        pfnCmdSetPrimitiveTopology(commandBuffer, config.pipelineVariant.topology);
+    }
+
+    /* Bind the mesh and the per-instance attributes */
+    VkBuffer vertexBuffers[] = { vertexBuffer, instanceBuffer };
+    VkDeviceSize offsets[] = { 0, 0 };
+    if (config.animateInstances) {
+        vertexBuffers[1] = animatedInstanceBuffer;
+        offsets[1] = VkDeviceSize(imageIndex) * config.instanceCount * sizeof(InstanceData);
+    }
+    vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+    vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+
+    /* Draw every instance of the mesh, as many times as requested */
+    if (!useGpuCulling) {
+        for (uint32_t draw = 0; draw < drawCount; ++draw)
+            vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(MESH_INDICES.size()),
+                    config.instanceCount, 0, 0, 0);
+        return;
+    }
+
+    /* Or just those that survived culling, each with a draw of its own */
+    IndirectDraws draws = getIndirectDraws(imageIndex);
+    for (uint32_t draw = 0; draw < drawCount; ++draw)
+        if (useDrawIndirectCount)
+            pfnCmdDrawIndexedIndirectCount(commandBuffer, draws.commands, draws.commandsOffset,
+                    draws.count, draws.countOffset, config.instanceCount,
+                    sizeof(VkDrawIndexedIndirectCommand));
+        else
+            vkCmdDrawIndexedIndirect(commandBuffer, draws.commands, draws.commandsOffset,
+                    config.instanceCount, sizeof(VkDrawIndexedIndirectCommand));
+}
+
+void
+HelloTriangleApplication::recordSecondaryCommands(VkCommandBuffer commandBuffer,
+        uint32_t imageIndex, uint32_t drawCount, VkCommandBufferUsageFlags flags) {
+    /* Secondary buffers executed inside a render pass have to know which one, and those
+     * executed inside dynamic rendering what they render to */
+    VkCommandBufferInheritanceRenderingInfo renderingInfo {};
+    renderingInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+    renderingInfo.colorAttachmentCount = 1;
+    renderingInfo.pColorAttachmentFormats = &swapChainImageFormat;
+    renderingInfo.rasterizationSamples = msaaSamples;
+
+    VkCommandBufferInheritanceInfo inheritanceInfo {};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    if (useDynamicRendering) {
+        inheritanceInfo.pNext = &renderingInfo;
+    } else {
+        inheritanceInfo.renderPass = renderPass;
+        inheritanceInfo.subpass = 0;
+        inheritanceInfo.framebuffer = swapChainFramebuffers[imageIndex];
+    }
+
+    VkCommandBufferBeginInfo beginInfo {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | flags;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+        throw std::runtime_error("Failed to begin recording secondary command buffer.");
+
+    /* State isn't inherited from the primary, so every slice binds everything itself */
+    recordDraws(commandBuffer, imageIndex, drawCount);
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+        throw std::runtime_error("Failed to record secondary command buffer.");
+}
+
+VkCommandBuffer
+HelloTriangleApplication::recordSecondaryCommandBuffer(VkCommandPool pool,
+        uint32_t imageIndex, uint32_t drawCount) {
+    VkCommandBufferAllocateInfo allocInfo {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = pool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer commandBuffer;
+    if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, &commandBuffer) != VK_SUCCESS)
+        throw std::runtime_error("Failed to allocate secondary command buffer.");
+
+    recordSecondaryCommands(commandBuffer, imageIndex, drawCount, 0);
+    return commandBuffer;
+}
+
+void
+HelloTriangleApplication::createFrameCommandPools() {
+    /* Buffers are recorded for a single submission and reset along with their whole pool,
+     * never one by one */
+    VkCommandPoolCreateInfo poolInfo {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = graphicsFamily;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+    size_t slotCount = std::max(config.framesInFlight, MAX_PROFILE_FRAMES_IN_FLIGHT);
+    uint32_t sliceCount = getSliceCount();
+    frameCommandPools.resize(slotCount);
+    frameCommandBuffers.resize(slotCount);
+    if (sliceCount > 1) {
+        frameSecondaryCommandPools.resize(slotCount * sliceCount);
+        frameSecondaryCommandBuffers.resize(slotCount * sliceCount);
+    }
+
+    auto createPool = [&](VkCommandPool& pool, VkCommandBuffer& commandBuffer,
+                          VkCommandBufferLevel level) {
+        if (vkCreateCommandPool(logicalDevice, &poolInfo, commandPoolCallbacks, &pool)
+                != VK_SUCCESS)
+            throw std::runtime_error("Failed to create frame command pool.");
+
+        VkCommandBufferAllocateInfo allocInfo {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = pool;
+        allocInfo.level = level;
+        allocInfo.commandBufferCount = 1;
+        if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, &commandBuffer) != VK_SUCCESS)
+            throw std::runtime_error("Failed to allocate frame command buffer.");
+    };
+
+    /* A slice is recorded by a single job at a time, so it can have a pool to itself
+     * whichever thread the job lands on */
+    for (size_t i = 0; i < frameCommandPools.size(); ++i)
+        createPool(frameCommandPools[i], frameCommandBuffers[i], VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+    for (size_t i = 0; i < frameSecondaryCommandPools.size(); ++i)
+        createPool(frameSecondaryCommandPools[i], frameSecondaryCommandBuffers[i],
+                VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+}
+
+VkCommandBuffer
+HelloTriangleApplication::recordFrameCommandBuffer(uint32_t imageIndex) {
+    /* The slot's last frame has completed, so its buffers can go back to the initial state
+     * in one go; the pools keep their memory for the new recording */
+    uint32_t sliceCount = getSliceCount();
+    vkResetCommandPool(logicalDevice, frameCommandPools[currentFrame], 0);
+    if (!frameArenas.empty()) resetFrameArena();
+
+    const VkCommandBuffer *secondaries = nullptr;
+    if (sliceCount > 1) {
+        for (uint32_t slice = 0; slice < sliceCount; ++slice)
+            vkResetCommandPool(logicalDevice,
+                    frameSecondaryCommandPools[currentFrame * sliceCount + slice], 0);
+
+        secondaries = &frameSecondaryCommandBuffers[currentFrame * sliceCount];
+        uint32_t sliceSize = (config.drawCount + sliceCount - 1) / sliceCount;
+
+        jobSystem->parallelFor(sliceCount, 1,
+                [this, imageIndex, secondaries, sliceSize](size_t begin, size_t end, size_t) {
+                    for (size_t slice = begin; slice < end; ++slice) {
+                        uint32_t firstDraw = static_cast<uint32_t>(slice) * sliceSize;
+                        recordSecondaryCommands(secondaries[slice], imageIndex,
+                                std::min(sliceSize, config.drawCount - firstDraw),
+                                VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+                    }
+                });
+    }
+
+    VkCommandBuffer commandBuffer = frameCommandBuffers[currentFrame];
+    recordCommandBuffer(commandBuffer, imageIndex, secondaries, sliceCount,
+            VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+    return commandBuffer;
 }
 
 void
 HelloTriangleApplication::drawFrame() {
-    /* Wait for fence to release before drawing */
-    vkWaitForFences(logicalDevice, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+    applyRequestedPresentProfile();
+
+    auto frameStart = std::chrono::steady_clock::now();
+    FrameTiming timing {};
+    timing.frame = frameNumber;
+    timing.paceMs = framePacer ? framePacer->getLastWaitMs() : 0.0;
+
+    auto stepStart = std::chrono::steady_clock::now();
+    if (useTimelineSemaphore) {
+        /* Frame n may start once frame n - framesInFlight has finished */
+        if (frameNumber + 1 > framesInFlight)
+            waitForFrameCount(frameNumber + 1 - framesInFlight);
+        /* After a profile switch, the slot may have been used more recently than that */
+        waitForFrameCount(inFlightFrameCounts[currentFrame]);
+    } else {
+        /* Wait for fence to release before drawing */
+        vkWaitForFences(logicalDevice, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+
+        /* Frames complete in submission order, so everything up to this slot's frame is done */
+        completedFrameCount = std::max(completedFrameCount, inFlightFrameCounts[currentFrame]);
+    }
+    timing.fenceWaitMs = millisecondsSince(stepStart);
+
+    releaseRetiredSwapChains(false);
+    releaseUploadBatches(false);
+    if (frameCapture) collectCaptures(false);
+    if (hostAllocator) hostAllocator->resetFrameArena();
 
     uint32_t imageIndex;
-    /* Acquire an image from the swap chain */
-    vkAcquireNextImageKHR(logicalDevice, swapChain, UINT64_MAX,
-            imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+    stepStart = std::chrono::steady_clock::now();
+    if (config.headless)
+        /* Offscreen images are simply used round-robin */
+        imageIndex = static_cast<uint32_t>(frameNumber % swapChainImages.size());
+    else {
+        /* Acquire an image from the swap chain */
+        VkResult result = vkAcquireNextImageKHR(logicalDevice, swapChain, UINT64_MAX,
+                imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+
+        /* The swap chain no longer matches the surface; nothing was acquired, so retry with
+         * a new one next frame (a suboptimal image is still fine to draw to) */
+        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+            recreateSwapChain();
+            return;
+        } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+            throw std::runtime_error("Failed to acquire swap chain image.");
+    }
+    timing.acquireMs = millisecondsSince(stepStart);
 
     /* Check if a previous frame uses same image */
-    if (imagesInFlight[imageIndex] != VK_NULL_HANDLE)
-        vkWaitForFences(logicalDevice, 1, &imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
-    imagesInFlight[imageIndex] = inFlightFences[currentFrame];
+    stepStart = std::chrono::steady_clock::now();
+    if (useTimelineSemaphore) {
+        waitForFrameCount(imageFrameCounts[imageIndex]);
+        imageFrameCounts[imageIndex] = frameNumber + 1;
+    } else {
+        if (imagesInFlight[imageIndex] != VK_NULL_HANDLE)
+            vkWaitForFences(logicalDevice, 1, &imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
+        imagesInFlight[imageIndex] = inFlightFences[currentFrame];
+    }
+    timing.fenceWaitMs += millisecondsSince(stepStart);
+
+    /* The image's previous submission is done, so its timestamps can be read back */
+    collectFrameTiming(imageIndex);
+
+    /* Nor does anything read the image's instances anymore, so they can be animated */
+    if (config.animateInstances) submitInstanceAnimation(imageIndex);
+
+    /* Either record the frame now, or use the image's pre-recorded command buffer */
+    stepStart = std::chrono::steady_clock::now();
+    VkCommandBuffer frameCommands = config.rerecordCommandBuffers
+                                        ? recordFrameCommandBuffer(imageIndex)
+                                        : commandBuffers[imageIndex];
+    timing.recordMs = millisecondsSince(stepStart);
 
     VkSubmitInfo submitInfo {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-    /* Synchronize submission of command buffer into queue */
-    VkSemaphore waitSemaphores[] = { imageAvailableSemaphores[currentFrame] };
-    VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame] };
-    VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-    /* Choose semaphore to wait on before executing command buffer */
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = waitSemaphores;
-    submitInfo.pWaitDstStageMask = waitStages;
-    /* Specify command buffers */
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
+    /* Synchronize submission of command buffer into queue: wait for the image (nothing to wait
+     * for when headless, since no image is acquired) and for uploads not waited on yet */
+    flushUploads();
+    waitSemaphores.clear();
+    waitStages.clear();
+    submitCommandBuffers.clear();
+    if (!config.headless) {
+        waitSemaphores.push_back(imageAvailableSemaphores[currentFrame]);
+        waitStages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+    }
+    if (config.animateInstances) {
+        waitSemaphores.push_back(computeFinishedSemaphores[currentFrame]);
+        /* Culling reads the instances before the vertex shader does */
+        waitStages.push_back(useGpuCulling ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                                           : VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+    }
+    for (auto& batch : uploadBatches)
+        if (batch.frameCount == 0) {
+            waitSemaphores.push_back(batch.semaphore);
+            waitStages.push_back(batch.dstStages);
+            if (batch.acquireCommands != VK_NULL_HANDLE)
+                submitCommandBuffers.push_back(batch.acquireCommands);
+            batch.frameCount = frameNumber + 1;
+        }
+    submitCommandBuffers.push_back(frameCommands);
+    /* Copy the image out once drawn, before it is presented */
+    VkCommandBuffer captureCommands = recordCapture(imageIndex);
+    if (captureCommands != VK_NULL_HANDLE) submitCommandBuffers.push_back(captureCommands);
+
+    /* Signal presentation (unless headless) and the frame counter (if we have one) */
+    VkSemaphore signalSemaphores[2];
+    uint64_t signalValues[2];
+    uint32_t signalCount = 0;
+    if (!config.headless) {
+        signalSemaphores[signalCount] = renderFinishedSemaphores[currentFrame];
+        signalValues[signalCount++] = 0; /* Ignored for binary semaphores */
+    }
+    if (useTimelineSemaphore) {
+        signalSemaphores[signalCount] = frameTimeline;
+        signalValues[signalCount++] = frameNumber + 1;
+    }
+    /* Choose semaphores to wait on before executing command buffers */
+    submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+    submitInfo.pWaitSemaphores = waitSemaphores.data();
+    submitInfo.pWaitDstStageMask = waitStages.data();
+    /* Specify command buffers: ownership transfers of uploads first, then the frame itself */
+    submitInfo.commandBufferCount = static_cast<uint32_t>(submitCommandBuffers.size());
+    submitInfo.pCommandBuffers = submitCommandBuffers.data();
     /* Choose semaphore to wait on before signaling completed command buffer execution */
-    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.signalSemaphoreCount = signalCount;
     submitInfo.pSignalSemaphores = signalSemaphores;
 
-    /* Reset current frame fence */
-    vkResetFences(logicalDevice, 1, &inFlightFences[currentFrame]);
+    VkTimelineSemaphoreSubmitInfo timelineInfo {};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.signalSemaphoreValueCount = signalCount;
+    timelineInfo.pSignalSemaphoreValues = signalValues;
+
+    VkFence submitFence = VK_NULL_HANDLE;
+    if (useTimelineSemaphore)
+        submitInfo.pNext = &timelineInfo;
+    else {
+        /* Reset current frame fence */
+        submitFence = inFlightFences[currentFrame];
+        vkResetFences(logicalDevice, 1, &submitFence);
+    }
+
     /* Submit command buffers into graphics queue */
-    if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame])
-            != VK_SUCCESS)
+    stepStart = std::chrono::steady_clock::now();
+    if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, submitFence) != VK_SUCCESS)
         throw std::runtime_error("Failed to submit draw command buffer.");
+    inFlightFrameCounts[currentFrame] = frameNumber + 1;
+    timing.submitMs = millisecondsSince(stepStart);
+
+    stepStart = std::chrono::steady_clock::now();
+    bool swapChainStale = false;
+    if (!config.headless) {
+        VkResult result = present(imageIndex, signalSemaphores);
+        if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+            swapChainStale = true;
+        else if (result != VK_SUCCESS)
+            throw std::runtime_error("Failed to present swap chain image.");
+    }
+    timing.presentMs = millisecondsSince(stepStart);
+
+    /* Hold on to the CPU timings until the GPU has finished with this image */
+    timing.cpuFrameMs = millisecondsSince(frameStart);
+    timing.gpuMs = -1.0;
+    pendingTimings[imageIndex] = timing;
+
+    /* Increment current frame index */
+    currentFrame = (currentFrame + 1) % framesInFlight;
+    ++frameNumber;
+
+    /* Recreate after the frame is counted, so the retired swap chain waits for it too */
+    if (swapChainStale || framebufferResized) {
+        framebufferResized = false;
+        recreateSwapChain();
+    }
+}
+
+void
+HelloTriangleApplication::createTimestampQueryPool() {
+    pendingTimings.assign(swapChainImages.size(), std::nullopt);
+
+    /* Timestamps are only usable if the graphics queue reports valid bits for them */
+    uint32_t validBits = deviceInfo.queueFamilies[graphicsFamily].timestampValidBits;
+    if (validBits == 0) return;
+
+    timestampPeriod = deviceInfo.properties.limits.timestampPeriod;
+    timestampMask = validBits >= 64 ? UINT64_MAX : ((uint64_t) 1 << validBits) - 1;
 
+    /* Set up one begin/end pair of queries per command buffer */
+    VkQueryPoolCreateInfo createInfo {};
+    createInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    createInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    createInfo.queryCount = static_cast<uint32_t>(2 * swapChainImages.size());
+
+    if (vkCreateQueryPool(logicalDevice, &createInfo, deviceCallbacks, &timestampQueryPool)
+            != VK_SUCCESS)
+        throw std::runtime_error("Failed to create timestamp query pool.");
+}
+
+void
+HelloTriangleApplication::collectFrameTiming(uint32_t imageIndex) {
+    if (!pendingTimings[imageIndex].has_value()) return;
+
+    FrameTiming timing = pendingTimings[imageIndex].value();
+    pendingTimings[imageIndex].reset();
+
+    if (timestampQueryPool != VK_NULL_HANDLE) {
+        uint64_t timestamps[2];
+        /* Don't wait; the submission is known to be complete, and a miss just drops the sample */
+        if (vkGetQueryPoolResults(logicalDevice, timestampQueryPool, 2 * imageIndex, 2,
+                    sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT)
+                == VK_SUCCESS) {
+            uint64_t ticks = ((timestamps[1] & timestampMask) - (timestamps[0] & timestampMask))
+                             & timestampMask;
+            timing.gpuMs = ticks * timestampPeriod / 1e6;
+        }
+    }
+
+    frameStats.push(timing);
+}
+
+void
+HelloTriangleApplication::reportFrameStats() {
+    if (config.printStats) {
+        std::cout << "Device: " << deviceInfo.properties.deviceName << "\n";
+        std::cout << "Rendering: " << (useDynamicRendering ? "dynamic rendering" : "render pass")
+                  << "\n";
+        frameStats.writeSummary(std::cout);
+        if (framePacer) framePacer->writeSummary(std::cout);
+        deviceAllocator->writeStats(std::cout);
+        if (hostAllocator) hostAllocator->writeStats(std::cout);
+    }
+
+    if (!config.statsCsvPath.empty()) {
+        std::ofstream file(config.statsCsvPath);
+        if (!file.is_open())
+            throw std::runtime_error("Failed to open frame statistics file.");
+        frameStats.writeCsv(file);
+    }
+}
+
+VkResult
+HelloTriangleApplication::present(uint32_t imageIndex, VkSemaphore *waitSemaphores) {
     /* Submit result of command buffer submission back to swap chain for presentation */
     VkPresentInfoKHR presentationInfo {};
     presentationInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
     presentationInfo.waitSemaphoreCount = 1;
-    presentationInfo.pWaitSemaphores = signalSemaphores;
+    presentationInfo.pWaitSemaphores = waitSemaphores;
     VkSwapchainKHR swapChains[] = { swapChain };
     presentationInfo.swapchainCount = 1;
     presentationInfo.pSwapchains = swapChains;
     presentationInfo.pImageIndices = &imageIndex;
     presentationInfo.pResults = nullptr;
 
-    vkQueuePresentKHR(presentationQueue, &presentationInfo);
-    
-    /* Increment current frame index */
-    currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+    return vkQueuePresentKHR(presentationQueue, &presentationInfo);
 }
 
 void
 HelloTriangleApplication::createSynchronizationObjs() {
-    imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+    /* Create enough objects for any profile, so switching profiles never has to destroy
+     * objects that might still be in use */
+    size_t slotCount = std::max(config.framesInFlight, MAX_PROFILE_FRAMES_IN_FLIGHT);
+    imageAvailableSemaphores.resize(slotCount);
+    renderFinishedSemaphores.resize(slotCount);
+    inFlightFrameCounts.assign(slotCount, 0);
     imagesInFlight.resize(swapChainImages.size(), VK_NULL_HANDLE);
+    imageFrameCounts.assign(swapChainImages.size(), 0);
+
+    /* A single timeline semaphore counting finished frames stands in for the fences */
+    if (useTimelineSemaphore) {
+        VkSemaphoreTypeCreateInfo typeInfo {};
+        typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        typeInfo.initialValue = 0;
+
+        VkSemaphoreCreateInfo timelineInfo {};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        timelineInfo.pNext = &typeInfo;
+
+        if (vkCreateSemaphore(logicalDevice, &timelineInfo, deviceCallbacks, &frameTimeline)
+                != VK_SUCCESS)
+            throw std::runtime_error("Failed to create frame timeline semaphore.");
+    } else
+        inFlightFences.resize(slotCount);
 
     VkSemaphoreCreateInfo semaphoreInfo {};
     semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -855,20 +3332,61 @@ HelloTriangleApplication::createSynchronizationObjs() {
     fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
     fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+    for (size_t i = 0; i < slotCount; ++i) {
         /* Create both semaphores */
-        if (vkCreateSemaphore(logicalDevice, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i])
-                != VK_SUCCESS)
+        if (vkCreateSemaphore(logicalDevice, &semaphoreInfo, deviceCallbacks,
+                              &imageAvailableSemaphores[i]) != VK_SUCCESS)
             throw std::runtime_error("Failed to create image availability sempahore.");
-        if (vkCreateSemaphore(logicalDevice, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i])
-                != VK_SUCCESS)
+        if (vkCreateSemaphore(logicalDevice, &semaphoreInfo, deviceCallbacks,
+                              &renderFinishedSemaphores[i]) != VK_SUCCESS)
             throw std::runtime_error("Failed to create render completion sempahore.");
         /* Create fence */
-        if (vkCreateFence(logicalDevice, &fenceInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS)
+        if (!useTimelineSemaphore &&
+                vkCreateFence(logicalDevice, &fenceInfo, deviceCallbacks, &inFlightFences[i])
+                        != VK_SUCCESS)
             throw std::runtime_error("Failed to create fence.");
     }
 }
 
+void
+HelloTriangleApplication::waitForFrameCount(uint64_t count) {
+    if (completedFrameCount >= count) return;
+
+    /* Reading the counter is cheaper than a wait, and often enough already */
+    uint64_t value = 0;
+    pfnGetSemaphoreCounterValue(logicalDevice, frameTimeline, &value);
+
+    if (value < count) {
+        VkSemaphoreWaitInfo waitInfo {};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &frameTimeline;
+        waitInfo.pValues = &count;
+
+        if (pfnWaitSemaphores(logicalDevice, &waitInfo, UINT64_MAX) != VK_SUCCESS)
+            throw std::runtime_error("Failed to wait on frame timeline semaphore.");
+        value = count;
+    }
+
+    completedFrameCount = std::max(completedFrameCount, value);
+}
+
+uint64_t
+HelloTriangleApplication::getCompletedFrameCount() {
+    if (useTimelineSemaphore) {
+        uint64_t value = 0;
+        pfnGetSemaphoreCounterValue(logicalDevice, frameTimeline, &value);
+        completedFrameCount = std::max(completedFrameCount, value);
+    } else
+        /* Poll the fences of frames still in flight */
+        for (size_t i = 0; i < inFlightFences.size(); ++i)
+            if (inFlightFrameCounts[i] > completedFrameCount &&
+                    vkGetFenceStatus(logicalDevice, inFlightFences[i]) == VK_SUCCESS)
+                completedFrameCount = inFlightFrameCounts[i];
+
+    return completedFrameCount;
+}
+
 void
 HelloTriangleApplication::populateDebugMessengerCreateInfo(
         VkDebugUtilsMessengerCreateInfoEXT& createInfo) {
@@ -885,7 +3403,7 @@ HelloTriangleApplication::populateDebugMessengerCreateInfo(
                              VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
     /* Point to our callback function */
     createInfo.pfnUserCallback = debugCallback;
-    createInfo.pUserData = nullptr;
+    createInfo.pUserData = debugSink.get();
 }
 
 void
@@ -895,27 +3413,36 @@ HelloTriangleApplication::setupDebugMessenger() {
     VkDebugUtilsMessengerCreateInfoEXT createInfo;
     populateDebugMessengerCreateInfo(createInfo);
 
-    if (CreateDebugUtilsMessengerEXT(instance, &createInfo, nullptr, &debugMessenger)
+    if (CreateDebugUtilsMessengerEXT(instance, &createInfo, instanceCallbacks, &debugMessenger)
             != VK_SUCCESS)
         throw std::runtime_error("Failed to set up debug messenger.");
 }
 
-std::vector<char>
-HelloTriangleApplication::readFile(const std::string& filename) {
-    /* ate = AT End of file, binary = read in raw bytes */
-    std::ifstream file(filename, std::ios::ate | std::ios::binary);
-
-    if (!file.is_open())
-        throw std::runtime_error("Failed to open file.");
-
-    size_t fileSize = (size_t) file.tellg();
-    std::vector<char> buffer(fileSize);
+void
+HelloTriangleApplication::framebufferResizeCallback(GLFWwindow *window, int width, int height) {
+    (void) width;  /* Unused; the new size is queried when the swap chain is recreated */
+    (void) height; /* Unused */
 
-    file.seekg(0);
-    file.read(buffer.data(), fileSize);
+    auto app = reinterpret_cast<HelloTriangleApplication *>(glfwGetWindowUserPointer(window));
+    app->framebufferResized = true;
+}
 
-    file.close();
-    return buffer;
+void
+HelloTriangleApplication::keyCallback(
+        GLFWwindow *window, int key, int scancode, int action, int mods) {
+    (void) scancode; /* Unused */
+    (void) mods;     /* Unused */
+
+    if (action != GLFW_PRESS) return;
+
+    auto app = reinterpret_cast<HelloTriangleApplication *>(glfwGetWindowUserPointer(window));
+    switch (key) {
+        case GLFW_KEY_1: app->setPresentProfile(PresentProfile::LowLatency); break;
+        case GLFW_KEY_2: app->setPresentProfile(PresentProfile::Balanced); break;
+        case GLFW_KEY_3: app->setPresentProfile(PresentProfile::Throughput); break;
+        case GLFW_KEY_4: app->setPresentProfile(PresentProfile::PowerSaving); break;
+        default: break;
+    }
 }
 
 VKAPI_ATTR VkBool32 VKAPI_CALL
@@ -924,48 +3451,11 @@ HelloTriangleApplication::debugCallback(
         VkDebugUtilsMessageTypeFlagsEXT messageType,
         const VkDebugUtilsMessengerCallbackDataEXT *pCallbackData,
         void *pUserData) {
-    (void) pUserData; /* Unused */
-
-    std::string severity;
-    std::string type;
-
-    switch (messageSeverity) {
-        case VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT:
-            severity = "verbose";
-            break;
-        case VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT:
-            severity = "info";
-            break;
-        case VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT:
-            severity = "warning";
-            break;
-        case VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT:
-            severity = "error";
-            break;
-        default:
-            severity = "-";
-    }
-
-    switch (messageType) {
-        case VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT:
-            type = "general";
-            break;
-        case VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT:
-            type = "validation";
-            break;
-        case VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT:
-            type = "performance";
-            break;
-        default:
-            type = "-";
-    }
-
-    std::cerr
-        << "[" << severity << "] "
-        << "[" << type << "] "
-        << "Validation layer: "
-        << pCallbackData->pMessage
-        << std::endl;
+    /* Called on whichever thread made the offending call; queue the message and get out of
+     * the way, the sink's own thread writes it */
+    auto sink = static_cast<DebugSink *>(pUserData);
+    sink->push(messageSeverity, messageType, pCallbackData->messageIdNumber,
+               pCallbackData->pMessage);
 
     return VK_FALSE;
 }
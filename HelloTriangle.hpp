@@ -1,27 +1,158 @@
 #ifndef HELLO_TRIANGLE_H
 #define HELLO_TRIANGLE_H
 
+#include "DebugSink.hpp"
+#include "DeviceAllocator.hpp"
+#include "DeviceSelector.hpp"
+#include "FrameCapture.hpp"
+#include "FramePacer.hpp"
+#include "FrameStats.hpp"
+#include "HostAllocator.hpp"
+#include "JobSystem.hpp"
+#include "PipelineRegistry.hpp"
+#include "ShaderBinary.hpp"
+#include "StagingRing.hpp"
+
 #include "vulkan/vulkan_core.h"
+#include <array>
+#include <chrono>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <utility>
 #include <vector>
 #include <optional>
 
 #define GLFW_INCLUDE_VULKAN 
 #include <GLFW/glfw3.h>
 
+/* Trade-offs between input latency, throughput and power when presenting frames */
+enum class PresentProfile {
+    LowLatency,  /* IMMEDIATE presentation, one frame in flight, fewest images */
+    Balanced,    /* MAILBOX if available (else FIFO), AppConfig::framesInFlight frames */
+    Throughput,  /* MAILBOX/FIFO_RELAXED, three frames in flight, at least three images */
+    PowerSaving, /* FIFO (vsync), two frames in flight */
+};
+
+/* Options controlling how the application is set up and run */
+struct AppConfig {
+    bool headless = false;           /* Render into offscreen images; no window or swap chain */
+    uint32_t headlessImageCount = 3; /* Number of offscreen render targets in headless mode */
+    uint64_t frameCount = 0;         /* Stop after this many frames (0 = until window closes) */
+    /* Where the pipeline cache is persisted between runs (empty = don't persist); the program
+     * defaults it to the user's cache directory */
+    std::string pipelineCachePath;
+    /* Directory to map the .spv files from; empty = use the shaders compiled into the program
+     * (or build/ if they weren't) */
+    std::string shaderDir;
+    /* Presentation policy to start with; can be switched at runtime */
+    PresentProfile presentProfile = PresentProfile::Balanced;
+    size_t framesInFlight = 2; /* Frames in flight under the balanced profile */
+    uint32_t drawCount = 1;    /* Number of draw calls recorded per frame */
+    uint32_t instanceCount = 1; /* Instances of the mesh drawn by each draw call */
+    /* Animate the instances with a compute shader every frame (on an async queue if any) */
+    bool animateInstances = false;
+    /* Cull the instances on the GPU and draw the survivors with indirect draws, if the device
+     * supports multi-draw indirect */
+    bool gpuDriven = false;
+    uint32_t recordThreads = 0; /* Threads recording draws (0 = one per hardware thread) */
+    /* Record each frame's command buffers anew, from pools of its own, instead of recording
+     * one command buffer per image up front */
+    bool rerecordCommandBuffers = false;
+    PipelineVariant pipelineVariant; /* Pipeline state to draw with */
+    /* Build the other blend and cull variants in the background after the first pipeline */
+    bool prewarmPipelines = false;
+    /* Pace frames with a timeline semaphore when the device supports Vulkan 1.2 */
+    bool allowTimelineSemaphore = true;
+    /* Set cull mode, front face and topology per command buffer if the device can
+     * (VK_EXT_extended_dynamic_state), so fewer pipeline variants are needed */
+    bool allowExtendedDynamicState = true;
+    /* Render with vkCmdBeginRendering straight into the image views if the device can (Vulkan
+     * 1.3 or VK_KHR_dynamic_rendering), instead of through a render pass and framebuffers */
+    bool allowDynamicRendering = true;
+    /* Serve the driver's host memory from our own pools, tracked per object category */
+    bool hostAllocator = false;
+    size_t hostMemoryLimit = 0; /* Host memory the driver may hold at once (0 = no limit) */
+    /* Presentation mode to use if the surface supports it, overriding the starting profile */
+    std::optional<VkPresentModeKHR> presentMode;
+    /* Hold the render loop to this many frames per second, sleeping in between and waking
+     * just in time to poll input and draw (0 = as fast as the present mode allows) */
+    double targetFps = 0.0;
+    bool printStats = false;  /* Print a frame timing summary when the run ends */
+    std::string statsCsvPath; /* Dump per-frame timings as CSV here when the run ends */
+    /* Copy frames back to the host, to write them as PPM files into captureDir and/or compare
+     * them with the files of the same name in goldenDir (empty = don't) */
+    std::string captureDir;
+    std::string goldenDir;
+    uint32_t captureInterval = 1; /* Capture every nth frame */
+    uint32_t goldenTolerance = 2; /* Largest difference per channel that still matches */
+
+    bool capturesFrames() const { return !captureDir.empty() || !goldenDir.empty(); }
+};
+
 class HelloTriangleApplication {
     public:
-        HelloTriangleApplication();
+        HelloTriangleApplication(const AppConfig& config = AppConfig());
         ~HelloTriangleApplication();
 
         /* Run the Vulkan application */
         void run();
 
+        /* Timings of the most recently drawn frames */
+        const FrameStats& getFrameStats() const { return frameStats; }
+        /* Time taken by each step of initialization, in milliseconds */
+        const std::vector<std::pair<std::string, double>>& getInitTimings() const {
+            return initTimings;
+        }
+        /* The presentation mode in use (meaningless in headless mode) */
+        VkPresentModeKHR getPresentMode() const { return swapChainPresentMode; }
+        /* Device memory usage of the allocator */
+        DeviceAllocatorStats getMemoryStats() const { return deviceAllocator->getStats(); }
+        /* The frame pacer, or nullptr if frames aren't paced */
+        const FramePacer *getFramePacer() const { return framePacer.get(); }
+        /* Host memory the driver holds through our allocator; all zero if it is not in use */
+        HostMemoryStats getHostMemoryStats() const {
+            return hostAllocator ? hostAllocator->getTotalStats() : HostMemoryStats();
+        }
+        /* Number of vertices the GPU processes per frame, over all draws and instances */
+        uint64_t getVerticesPerFrame() const {
+            return uint64_t(MESH_INDICES.size()) * config.instanceCount * config.drawCount;
+        }
+        /* Switch presentation policy; takes effect at the start of the next frame */
+        void setPresentProfile(PresentProfile profile) { requestedPresentProfile = profile; }
+        /* Number of frames the GPU has finished; frame n is done once this exceeds n */
+        uint64_t getCompletedFrameCount();
+        /* Check whether the GPU has finished a given frame */
+        bool isFrameComplete(uint64_t frame) { return getCompletedFrameCount() > frame; }
+
     private:
+        /* Layout of a mesh vertex in the vertex buffer */
+        struct Vertex {
+            float position[2];
+            float color[3];
+        };
+        /* Layout of per-instance data in the instance buffer */
+        struct InstanceData {
+            float offset[2]; /* Added to the scaled position, in clip space */
+            float scale;
+        };
+
+        /* The mesh drawn by every instance */
+        static constexpr std::array<Vertex, 3> MESH_VERTICES = {{
+            { {  0.0f, -0.5f }, { 1.0f, 0.0f, 0.0f } },
+            { {  0.5f,  0.5f }, { 0.0f, 1.0f, 0.0f } },
+            { { -0.5f,  0.5f }, { 0.0f, 0.0f, 1.0f } },
+        }};
+        static constexpr std::array<uint16_t, 3> MESH_INDICES = {{ 0, 1, 2 }};
+
         /* Struct to hold queue family indices */
         struct QueueFamilyIndices {
             std::optional<uint32_t> graphicsFamily;
             std::optional<uint32_t> presentationFamily;
+            /* A transfer-only family if there is one, the graphics family otherwise */
+            std::optional<uint32_t> transferFamily;
+            /* A compute family without graphics if there is one, the graphics family otherwise */
+            std::optional<uint32_t> computeFamily;
 
             bool isComplete() {
                 return graphicsFamily.has_value() && presentationFamily.has_value();
@@ -37,6 +168,114 @@ class HelloTriangleApplication {
                 return !surfaceFormats.empty() && !presentationModes.empty();
             }
         };
+        /* What a presentation profile asks for */
+        struct PresentPolicy {
+            std::vector<VkPresentModeKHR> presentationModes; /* In order of preference */
+            size_t framesInFlight;
+            uint32_t minImageCount; /* Lower bound on swap chain images (0 = surface minimum) */
+            uint32_t extraImages;   /* Images requested beyond the surface minimum */
+        };
+        /* Objects tied to a replaced swap chain, kept alive until the GPU is done with them */
+        struct RetiredSwapChain {
+            uint64_t frameCount; /* Frames submitted before retirement; all must complete first */
+            VkSwapchainKHR swapChain;
+            std::vector<VkImageView> imageViews;
+            std::vector<VkFramebuffer> framebuffers;
+            std::vector<VkCommandBuffer> commandBuffers;
+            std::vector<VkCommandBuffer> secondaryCommandBuffers;
+            std::vector<VkCommandPool> secondaryCommandPools;
+            VkQueryPool timestampQueryPool;
+            VkBuffer animatedInstanceBuffer;
+            DeviceAllocation animatedInstanceMemory;
+            VkDescriptorSet computeDescriptorSet;
+            VkBuffer indirectBuffer;
+            DeviceAllocation indirectMemory;
+            VkBuffer drawCountBuffer;
+            DeviceAllocation drawCountMemory;
+            VkDescriptorSet cullDescriptorSet;
+            VkImage colorImage;
+            VkImageView colorImageView;
+            DeviceAllocation colorImageMemory;
+        };
+        /* Push constants of the instance animation compute shader */
+        struct AnimationParams {
+            uint32_t firstInstance;
+            uint32_t count;
+            uint32_t gridSize;
+            float time;
+        };
+        /* Push constants of the culling compute shader */
+        struct CullParams {
+            uint32_t firstObject;
+            uint32_t objectCount;
+            uint32_t firstCommand;
+            uint32_t countIndex;
+            uint32_t indexCount;
+            float boundingRadius;
+            float viewMin[2];
+            float viewMax[2];
+        };
+        /* Where the culling of a frame writes its draws, and where the draws are read from */
+        struct IndirectDraws {
+            VkBuffer commands;
+            VkDeviceSize commandsOffset;
+            VkBuffer count;
+            VkDeviceSize countOffset;
+            VkDescriptorSet descriptorSet; /* The culling's view of instances, draws and count */
+            uint32_t firstCommand;         /* The offsets above, as seen through the descriptors */
+            uint32_t countIndex;
+        };
+        /* An in-flight slot's arena for the data its frame alone uses, when re-recording */
+        struct FrameArena {
+            uint32_t arena = 0;
+            VkBuffer buffer = VK_NULL_HANDLE; /* Spans the whole arena */
+            VkDescriptorSet cullDescriptorSet = VK_NULL_HANDLE;
+            DeviceAllocation commands;        /* The frame's indirect draws */
+            DeviceAllocation drawCount;
+        };
+        /* A host-visible buffer of the readback ring */
+        struct CaptureSlot {
+            VkBuffer buffer = VK_NULL_HANDLE;
+            DeviceAllocation memory;
+            VkDeviceSize size = 0;
+            VkCommandBuffer commands = VK_NULL_HANDLE; /* Copies a frame into the buffer */
+            uint64_t frameCount = 0; /* Frames that must complete before it's read; 0 = free */
+            CapturedFrame frame;     /* The frame being copied, pixels aside */
+        };
+        /* A copy out of the staging ring waiting to be submitted */
+        struct PendingUpload {
+            VkBuffer buffer;
+            VkBufferCopy region;
+            VkPipelineStageFlags dstStage; /* Where rendering first reads the data */
+            VkAccessFlags dstAccess;       /* How rendering reads the data */
+        };
+        /* A submission of copies to the transfer queue */
+        struct UploadBatch {
+            VkCommandBuffer transferCommands;
+            VkCommandBuffer acquireCommands; /* Graphics side of the ownership transfer, if any */
+            VkSemaphore semaphore;           /* Waited on by the first frame submitted after */
+            VkPipelineStageFlags dstStages;  /* Stages that frame waits in */
+            VkFence fence;                   /* Signaled once the staged data has been copied */
+            uint64_t ringPosition;           /* Staging ring head right after the batch */
+            bool ringReleased;
+            uint64_t frameCount; /* Frames submitted as of the frame that waited on it (0 = none) */
+        };
+        /* A step of initialization and the steps it has to wait for */
+        struct InitStep {
+            const char *name;
+            void (HelloTriangleApplication::*function)();
+            std::vector<const char *> dependencies; /* Names of steps that must finish first */
+            bool mainThread = false; /* Must run on the thread that owns the window */
+        };
+        /* Header prepended to pipeline cache data on disk, identifying the driver that made it */
+        struct PipelineCacheFileHeader {
+            uint32_t magic;
+            uint32_t vendorID;
+            uint32_t deviceID;
+            uint32_t driverVersion;
+            uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+            uint64_t dataSize;
+        };
 
         const uint32_t WIDTH = 800;
         const uint32_t HEIGHT = 600;
@@ -48,6 +287,13 @@ class HelloTriangleApplication {
         const bool enableValidationLayers = true;
         #endif
 
+        /* Most frames any profile keeps in flight; sync objects are created for this many */
+        const size_t MAX_PROFILE_FRAMES_IN_FLIGHT = 3;
+        /* Fewest draws worth handing to a recording thread of their own */
+        const uint32_t MIN_DRAWS_PER_SECONDARY = 256;
+        /* Size of the staging ring; uploads go through it in pieces of a quarter of it */
+        const VkDeviceSize STAGING_RING_SIZE = 32 << 20;
+
         /* Requested validation layers */
         const std::vector<const char *> requestedLayers = {
             "VK_LAYER_KHRONOS_validation"
@@ -57,45 +303,214 @@ class HelloTriangleApplication {
             VK_KHR_SWAPCHAIN_EXTENSION_NAME
         };
 
-        /* Bound the number of frames that can be in-flight at a time */
-        const size_t MAX_FRAMES_IN_FLIGHT = 2;
+        /* Format of the offscreen render targets in headless mode */
+        const VkFormat HEADLESS_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+
+        AppConfig config; /* Options the application was created with */
 
-        GLFWwindow *window;  /* The GLFW window */
+        GLFWwindow *window = nullptr; /* The GLFW window (null in headless mode) */
         VkInstance instance; /* The Vulkan instance */
+        uint32_t instanceApiVersion; /* The Vulkan version the instance was created for */
 
         VkPhysicalDevice physicalDevice /* The physical device */ = VK_NULL_HANDLE;
+        DeviceInfo deviceInfo; /* Properties of the physical device, queried when picking it */
+        QueueFamilyIndices queueFamilyIndices; /* Queue families picked on the physical device */
         VkDevice         logicalDevice; /* The logical device */
+        /* Sub-allocates all device memory; lives exactly as long as the logical device */
+        std::unique_ptr<DeviceAllocator> deviceAllocator;
 
         VkQueue graphicsQueue;     /* A queue to draw graphics */
         VkQueue presentationQueue; /* A queue to present images to the window */
+        VkQueue transferQueue;     /* A queue for uploads, separate from graphics if possible */
+        uint32_t graphicsFamily;   /* Queue family of the graphics queue */
+        uint32_t transferFamily;   /* Queue family of the transfer queue */
+        VkQueue computeQueue;      /* A queue for compute, separate from graphics if possible */
+        uint32_t computeFamily;    /* Queue family of the compute queue */
+
+        /* Uploads: staged in the ring, copied on the transfer queue, then handed to graphics */
+        VkCommandPool transferCommandPool;
+        std::unique_ptr<StagingRing> stagingRing;
+        std::vector<PendingUpload> pendingUploads;
+        std::vector<UploadBatch> uploadBatches; /* Submitted batches, oldest first */
+
+        /* What the current frame's submission waits on and runs; kept to reuse their storage */
+        std::vector<VkSemaphore> waitSemaphores;
+        std::vector<VkPipelineStageFlags> waitStages;
+        std::vector<VkCommandBuffer> submitCommandBuffers;
+
+        /* Instance animation: each frame, compute writes the instances of the image being drawn
+         * into that image's part of the animated instance buffer, which graphics then reads */
+        VkDescriptorSetLayout computeDescriptorSetLayout = VK_NULL_HANDLE;
+        VkPipelineLayout computePipelineLayout = VK_NULL_HANDLE;
+        VkPipeline computePipeline = VK_NULL_HANDLE;
+        VkDescriptorPool computeDescriptorPool = VK_NULL_HANDLE;
+        VkDescriptorSet computeDescriptorSet = VK_NULL_HANDLE;
+        VkCommandPool computeCommandPool = VK_NULL_HANDLE;
+        std::vector<VkCommandBuffer> computeCommandBuffers; /* One per in-flight slot */
+        std::vector<VkSemaphore> computeFinishedSemaphores; /* One per in-flight slot */
+        VkBuffer animatedInstanceBuffer = VK_NULL_HANDLE;
+        DeviceAllocation animatedInstanceMemory;
+        std::chrono::steady_clock::time_point animationStart;
+
+        /* GPU-driven rendering: each frame, compute culls the instances of the image being drawn
+         * and writes a draw for each survivor into that image's part of the indirect buffer,
+         * along with their number when the device can read draw counts from a buffer */
+        bool useGpuCulling = false;
+        bool useDrawIndirectCount = false;
+        PFN_vkCmdDrawIndexedIndirectCount pfnCmdDrawIndexedIndirectCount = nullptr;
+        VkDescriptorSetLayout cullDescriptorSetLayout = VK_NULL_HANDLE;
+        VkPipelineLayout cullPipelineLayout = VK_NULL_HANDLE;
+        VkPipeline cullPipeline = VK_NULL_HANDLE;
+        VkDescriptorPool cullDescriptorPool = VK_NULL_HANDLE;
+        VkDescriptorSet cullDescriptorSet = VK_NULL_HANDLE;
+        VkBuffer indirectBuffer = VK_NULL_HANDLE; /* VkDrawIndexedIndirectCommand per instance */
+        DeviceAllocation indirectMemory;
+        VkBuffer drawCountBuffer = VK_NULL_HANDLE; /* One uint32_t per image */
+        DeviceAllocation drawCountMemory;
+        /* When re-recording, every frame carves its draws and their count out of its slot's
+         * arena instead, which is reset once the slot's previous frame has completed */
+        std::vector<FrameArena> frameArenas;
 
         VkSurfaceKHR surface; /* The window surface for drawing */
 
-        VkSwapchainKHR swapChain;             /* The swap chain to buffer images */
+        VkSwapchainKHR swapChain = VK_NULL_HANDLE; /* The swap chain to buffer images */
         std::vector<VkImage> swapChainImages; /* The images in the swap chain */
         VkFormat swapChainImageFormat;        /* The format of the images */
         VkExtent2D swapChainExtent;           /* The resolution of the images */
+        VkPresentModeKHR swapChainPresentMode = VK_PRESENT_MODE_FIFO_KHR; /* How images are shown */
+        /* Memory backing the offscreen images that stand in for the swap chain when headless */
+        std::vector<DeviceAllocation> offscreenImageMemory;
+
+        /* Mesh and per-instance attributes, in device-local memory */
+        VkBuffer vertexBuffer = VK_NULL_HANDLE;
+        DeviceAllocation vertexBufferMemory;
+        VkBuffer indexBuffer = VK_NULL_HANDLE;
+        DeviceAllocation indexBufferMemory;
+        VkBuffer instanceBuffer = VK_NULL_HANDLE;
+        DeviceAllocation instanceBufferMemory;
 
         std::vector<VkImageView> swapChainImageViews; /* A view into images in the swap chain */
+        /* Multisampled color attachment, resolved into the image being drawn at the end of the
+         * render pass. Its contents never outlive a render pass, so one image serves every
+         * framebuffer and, where the device allows, is never backed by actual memory */
+        VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT; /* 1 = no multisampling */
+        VkImage colorImage = VK_NULL_HANDLE;
+        VkImageView colorImageView = VK_NULL_HANDLE;
+        DeviceAllocation colorImageMemory;
         std::vector<VkFramebuffer> swapChainFramebuffers; /* The framebuffers for rendering */
 
-        VkRenderPass renderPass; /* The actual render pass */
+        VkRenderPass renderPass = VK_NULL_HANDLE; /* The actual render pass */
+        VkPipelineCache pipelineCache; /* Cache of compiled pipeline state, persisted to disk */
         VkPipelineLayout pipelineLayout; /* A pipeline layout for shaders */
-        VkPipeline graphicsPipeline; /* The graphics pipeline */
+        /* Graphics pipeline variants, built on demand from the shader modules */
+        std::unique_ptr<PipelineRegistry> pipelineRegistry;
+        VkShaderModule vertShaderModule;
+        VkShaderModule fragShaderModule;
+        VkPipeline graphicsPipeline; /* The variant in use; owned by the registry */
+        /* SPIR-V of the shaders, kept to rebuild pipelines without going back to disk */
+        ShaderBinary vertShaderCode;
+        ShaderBinary fragShaderCode;
+        ShaderBinary compShaderCode;
+        ShaderBinary cullShaderCode;
 
         VkCommandPool commandPool; /* A memory pool to manage memory for command buffers */
         std::vector<VkCommandBuffer> commandBuffers; /* The command buffers */
 
+        /* Threads recording slices of the draws into secondary command buffers */
+        std::unique_ptr<JobSystem> jobSystem;
+        std::vector<VkCommandPool> recordCommandPools; /* One per job system thread */
+        /* Secondary command buffers of all images, with the pool each was allocated from */
+        std::vector<VkCommandBuffer> secondaryCommandBuffers;
+        std::vector<VkCommandPool> secondaryCommandPools;
+
+        /* Re-recording: every in-flight slot has a transient pool for its primary command
+         * buffer and one per slice for its secondaries, all reset at once when the slot is
+         * reused. Indexed by slot, or slot * slice count + slice */
+        std::vector<VkCommandPool> frameCommandPools;
+        std::vector<VkCommandBuffer> frameCommandBuffers;
+        std::vector<VkCommandPool> frameSecondaryCommandPools;
+        std::vector<VkCommandBuffer> frameSecondaryCommandBuffers;
+
+        /* Frame capture: frames are copied into a ring of host-visible buffers as part of their
+         * submission, read once a later frame finds them complete, and written and compared
+         * on the capture thread, so nothing ever waits for a capture */
+        std::unique_ptr<FrameCapture> frameCapture;
+        VkCommandPool captureCommandPool = VK_NULL_HANDLE;
+        std::vector<CaptureSlot> captureSlots;
+        size_t nextCaptureSlot = 0;
+        VkMemoryPropertyFlags captureMemoryProperties = 0;
+
         /* Semaphores for synchronizing drawing threads */
         std::vector<VkSemaphore> imageAvailableSemaphores;
         std::vector<VkSemaphore> renderFinishedSemaphores;
         /* Fences for CPU-GPU synchronization */
         std::vector<VkFence> inFlightFences;
         std::vector<VkFence> imagesInFlight;
+        /* Number of frames submitted as of each in-flight slot's last submission */
+        std::vector<uint64_t> inFlightFrameCounts;
+        uint64_t completedFrameCount = 0; /* Frames the GPU is known to have finished */
+
+        /* Timeline semaphore counting completed frames; replaces the fences when supported */
+        bool useTimelineSemaphore = false;
+        VkSemaphore frameTimeline = VK_NULL_HANDLE;
+        /* Frame count each image has to reach before it may be reused (timeline path) */
+        std::vector<uint64_t> imageFrameCounts;
+        PFN_vkWaitSemaphores pfnWaitSemaphores = nullptr;
+        PFN_vkGetSemaphoreCounterValue pfnGetSemaphoreCounterValue = nullptr;
+
+        /* Cull mode, front face and topology are dynamic state (VK_EXT_extended_dynamic_state) */
+        bool useExtendedDynamicState = false;
+        PFN_vkCmdSetCullModeEXT pfnCmdSetCullMode = nullptr;
+        PFN_vkCmdSetFrontFaceEXT pfnCmdSetFrontFace = nullptr;
+        PFN_vkCmdSetPrimitiveTopologyEXT pfnCmdSetPrimitiveTopology = nullptr;
+
+        /* Dynamic rendering: no render pass or framebuffers, the images are transitioned with
+         * synchronization2 barriers around vkCmdBeginRendering/vkCmdEndRendering */
+        bool useDynamicRendering = false;
+        PFN_vkCmdBeginRendering pfnCmdBeginRendering = nullptr;
+        PFN_vkCmdEndRendering pfnCmdEndRendering = nullptr;
+        PFN_vkCmdPipelineBarrier2 pfnCmdPipelineBarrier2 = nullptr;
+
+        bool framebufferResized = false; /* Set when the window's framebuffer changes size */
+        /* Swap chains replaced by recreation, waiting for their last frames to complete */
+        std::vector<RetiredSwapChain> retiredSwapChains;
+
+        /* Timestamp queries bracketing the render pass, two per command buffer */
+        VkQueryPool timestampQueryPool = VK_NULL_HANDLE;
+        float timestampPeriod;          /* Nanoseconds per timestamp tick */
+        uint64_t timestampMask;         /* Mask of valid timestamp bits */
+
+        FrameStats frameStats; /* Ring of recent frame timings */
+        std::unique_ptr<FramePacer> framePacer; /* Limits the frame rate, if one is targeted */
+        /* Milliseconds per init step, in order of completion; steps may overlap */
+        std::vector<std::pair<std::string, double>> initTimings;
+        std::mutex initTimingsMutex;
+        /* CPU timings of the last frame drawn to each image, waiting on its GPU timestamps */
+        std::vector<std::optional<FrameTiming>> pendingTimings;
+
+        PresentProfile presentProfile; /* The presentation policy in effect */
+        std::optional<PresentProfile> requestedPresentProfile; /* Policy to switch to */
+        size_t framesInFlight; /* Frames allowed in flight under the current policy */
 
         size_t currentFrame = 0; /* The index of the currently-drawn frame */
+        uint64_t frameNumber = 0; /* The number of frames submitted so far */
 
         VkDebugUtilsMessengerEXT debugMessenger; /* A debug messenger */
+        /* Writes the messenger's messages out off the reporting threads */
+        std::unique_ptr<DebugSink> debugSink;
+
+        /* Serves the driver's host memory if enabled. Objects of each category are created
+         * and destroyed with its callbacks, which are nullptr to leave the memory to the driver */
+        std::unique_ptr<HostAllocator> hostAllocator;
+        const VkAllocationCallbacks *instanceCallbacks = nullptr;
+        const VkAllocationCallbacks *deviceCallbacks = nullptr;
+        const VkAllocationCallbacks *pipelineCallbacks = nullptr;
+        const VkAllocationCallbacks *commandPoolCallbacks = nullptr;
+
+        /* Run one step of initialization and record how long it took */
+        void runInitStep(const char *name, void (HelloTriangleApplication::*step)());
+        /* Run steps of initialization on the job system, each once its dependencies are done */
+        void runInitSteps(const std::vector<InitStep>& steps);
 
         /* Initialize a GLFW window */
         void initWindow();
@@ -118,60 +533,193 @@ class HelloTriangleApplication {
         /* Pick a physical device that supports Vulkan, if it exists */
         void pickPhysicalDevice();
         /* Check whether a given device supports this application */
-        bool isDeviceSuitable(VkPhysicalDevice device);
+        bool isDeviceSuitable(const DeviceInfo& info);
 
         /* Assign indices to available queue families */
-        QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);
+        QueueFamilyIndices findQueueFamilies(const DeviceInfo& info);
+
+        /* Highest sample count the device can render with, up to the requested one */
+        VkSampleCountFlagBits chooseSampleCount(const DeviceInfo& info);
 
         /* Create a new logical device to interface with the physical one */
         void createLogicalDevice();
 
+        /* Get list of device extensions required in the current mode */
+        std::vector<const char *> getRequiredDeviceExtensions();
         /* Check whether the physical device supports the requested extensions */
-        bool checkDeviceExtensionSupport(VkPhysicalDevice device);
+        bool checkDeviceExtensionSupport(const DeviceInfo& info);
+        /* Check whether the physical device supports timeline semaphores */
+        bool checkTimelineSemaphoreSupport(const DeviceInfo& info);
+        /* Check whether the physical device supports VK_EXT_extended_dynamic_state */
+        bool checkExtendedDynamicStateSupport(const DeviceInfo& info);
+        /* Check whether the physical device can draw from a compacted list of indirect draws */
+        bool checkGpuCullingSupport(const DeviceInfo& info);
+        /* Check whether the physical device supports the Vulkan 1.2 drawIndirectCount feature */
+        bool checkDrawIndirectCountSupport(const DeviceInfo& info);
+        /* Check whether the physical device supports dynamic rendering and synchronization2,
+         * telling whether they are core (Vulkan 1.3) rather than extensions */
+        bool checkDynamicRenderingSupport(const DeviceInfo& info, bool& core);
 
         /* Create a new swap chain */
         void createSwapChain();
+        /* Create the multisampled color attachment, if multisampling */
+        void createColorResources();
         /* Find the swap chain properties supported by the physical device */
-        SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device);
+        SwapChainSupportDetails querySwapChainSupport();
         /* Prefer a specific surface format */
         VkSurfaceFormatKHR chooseSwapSurfaceFormat(
                 const std::vector<VkSurfaceFormatKHR>& availableSurfaceFormats);
+        /* Look up what a presentation profile asks for */
+        PresentPolicy getPresentPolicy(PresentProfile profile);
+        /* Switch to a requested presentation profile, if any, between frames */
+        void applyRequestedPresentProfile();
         /* Prefer a specific presentation mode */
         VkPresentModeKHR chooseSwapPresentationMode(
                 const std::vector<VkPresentModeKHR>& availablePresentationModes);
         /* Prefer the resolution of the window */
         VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR capabilities);
+        /* Create device-owned images to render into instead of a swap chain */
+        void createOffscreenImages();
         /* Create a way to access images in the render pipeline */
         void createImageViews();
+        /* Replace the swap chain and everything that depends on it, without stalling the GPU */
+        void recreateSwapChain();
+        /* Destroy retired swap chains whose frames have completed (or all of them) */
+        void releaseRetiredSwapChains(bool releaseAll);
 
         /* Create a way to specify framebuffer attachments */
         void createRenderPass();
 
-        /* Create the graphics pipeline */
+        /* Create the pipeline cache, seeded from disk if a compatible cache exists */
+        void createPipelineCache();
+        /* Load pipeline cache data from disk; empty if missing or made by another driver */
+        std::vector<char> loadPipelineCacheData();
+        /* Write the pipeline cache back to disk atomically */
+        void savePipelineCache();
+
+        /* Find the SPIR-V of every shader in use, embedded or on disk */
+        void loadShaderCode();
+        /* Create the pipeline layout and registry, and the pipeline of the configured variant */
         void createGraphicsPipeline();
+        /* Build the graphics pipeline of a variant; called by the registry from any thread */
+        VkPipeline buildGraphicsPipeline(const PipelineVariant& variant);
+        /* The part of a variant baked into its pipeline; the rest is set while recording */
+        PipelineVariant getBakedVariant(const PipelineVariant& variant);
+        /* Have the registry build the variants likely to be asked for next */
+        void prewarmPipelines();
         /* Create a shader module */
-        VkShaderModule createShaderModule(const std::vector<char>& shader);
+        VkShaderModule createShaderModule(const ShaderBinary& shader);
 
         /* Create framebuffers from swap chain */
         void createFramebuffers();
 
         /* Create a new command buffer memory pool */
         void createCommandPool();
-        /* Create command buffers */
+        /* Create the staging ring and the transfer command pool */
+        void createUploadResources();
+        /* Stage data for a buffer; it reaches the buffer before the next frame reads it */
+        void queueUpload(VkBuffer buffer, VkDeviceSize offset, const void *data,
+                         VkDeviceSize size, VkPipelineStageFlags dstStage,
+                         VkAccessFlags dstAccess);
+        /* Submit all staged copies to the transfer queue */
+        void flushUploads();
+        /* Block until the oldest upload batch holding staging space has finished */
+        void waitForStagingSpace();
+        /* Reclaim staging space and objects of upload batches that are done */
+        void releaseUploadBatches(bool releaseAll);
+        /* Create the capture thread and readback ring, if capturing frames */
+        void createCaptureResources();
+        /* (Re)create a readback buffer of at least the given size */
+        void createCaptureBuffer(CaptureSlot& slot, VkDeviceSize size);
+        /* Record copying an image into the next readback buffer; VK_NULL_HANDLE if the frame
+         * isn't captured */
+        VkCommandBuffer recordCapture(uint32_t imageIndex);
+        /* Hand the readbacks of completed frames to the capture thread; all of them if the
+         * device is idle */
+        void collectCaptures(bool collectAll);
+        /* Create and fill the vertex, index and instance buffers */
+        void createGeometryBuffers();
+        /* Create a buffer backed by memory from the device allocator, shared between the given
+         * queue families if they differ */
+        void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
+                          VkMemoryPropertyFlags properties, VkBuffer& buffer,
+                          DeviceAllocation& memory, std::vector<uint32_t> queueFamilies = {});
+        /* Create the compute pipeline and per-slot objects animating the instances */
+        void createComputePipeline();
+        /* Create the animated instance buffer, with room for every swap chain image */
+        void createAnimatedInstanceBuffer();
+        /* Record and submit the animation of the instances an image draws */
+        void submitInstanceAnimation(uint32_t imageIndex);
+        /* Create the culling compute pipeline, if culling on the GPU */
+        void createCullPipeline();
+        /* Create the indirect and draw count buffers, with room for every swap chain image */
+        void createIndirectBuffers();
+        /* Create an arena per in-flight slot for the culling output, when re-recording */
+        void createFrameArenas();
+        /* Reset the current slot's arena and allocate this frame's culling output from it */
+        void resetFrameArena();
+        /* Point a culling descriptor set at the instances, draws and draw count */
+        void writeCullDescriptorSet(VkDescriptorSet descriptorSet,
+                                    const std::array<VkDescriptorBufferInfo, 3>& buffers);
+        /* Where the frame drawing an image culls into and draws from */
+        IndirectDraws getIndirectDraws(uint32_t imageIndex) const;
+        /* Record the culling of the instances an image draws, ahead of its render pass */
+        void recordCulling(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+        /* Create a device-local buffer and queue an upload of data into it */
+        void createDeviceLocalBuffer(const void *data, VkDeviceSize size, VkBufferUsageFlags usage,
+                                     VkBuffer& buffer, DeviceAllocation& memory);
+        /* Bind the pipeline and geometry, then record the draws */
+        void recordDraws(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t drawCount);
+        /* Number of secondary command buffers the draws of a frame are split into (1 = none) */
+        uint32_t getSliceCount();
+        /* Create and record one command buffer per image, unless re-recording every frame */
         void createCommandBuffers();
+        /* Record the commands drawing into an image; secondaries holds the draws if there
+         * are several slices, otherwise they are recorded inline */
+        void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex,
+                                 const VkCommandBuffer *secondaries, uint32_t sliceCount,
+                                 VkCommandBufferUsageFlags flags);
+        /* Start drawing into an image, through the render pass or dynamic rendering; the draws
+         * come from secondary command buffers if secondaries is set */
+        void recordBeginRendering(VkCommandBuffer commandBuffer, uint32_t imageIndex,
+                                  bool secondaries);
+        /* Finish drawing into an image, leaving it ready to be presented or copied out */
+        void recordEndRendering(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+        /* Record a slice of the draws into a secondary command buffer for an image */
+        void recordSecondaryCommands(VkCommandBuffer commandBuffer, uint32_t imageIndex,
+                                     uint32_t drawCount, VkCommandBufferUsageFlags flags);
+        /* Allocate a secondary command buffer from a pool and record a slice into it */
+        VkCommandBuffer recordSecondaryCommandBuffer(VkCommandPool pool, uint32_t imageIndex,
+                                                     uint32_t drawCount);
+        /* Create the transient pools and command buffers of every in-flight slot */
+        void createFrameCommandPools();
+        /* Reset the current slot's pools and record its command buffers for an image */
+        VkCommandBuffer recordFrameCommandBuffer(uint32_t imageIndex);
+        /* Create a query pool for GPU timestamps, if the graphics queue supports them */
+        void createTimestampQueryPool();
+        /* Complete the pending timing of an image whose last submission has finished */
+        void collectFrameTiming(uint32_t imageIndex);
+        /* Print or dump frame timings as configured */
+        void reportFrameStats();
 
         /* Draw a frame on screen */
         void drawFrame();
+        /* Hand a rendered swap chain image to the presentation queue */
+        VkResult present(uint32_t imageIndex, VkSemaphore *waitSemaphores);
         /* Create semaphores and fences for synchronization */
         void createSynchronizationObjs();
+        /* Block until the GPU has finished a given number of frames (timeline path) */
+        void waitForFrameCount(uint64_t count);
 
         /* Populate debug messenger */
         void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo);
         /* Set up the debug messenger */
         void setupDebugMessenger();
 
-        /* Read in files */
-        static std::vector<char> readFile(const std::string& filename);
+        /* GLFW callback for window framebuffer size changes */
+        static void framebufferResizeCallback(GLFWwindow *window, int width, int height);
+        /* GLFW callback for key presses; number keys switch presentation profiles */
+        static void keyCallback(GLFWwindow *window, int key, int scancode, int action, int mods);
         /* Debug callback function */
         static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
                 VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
@@ -0,0 +1,346 @@
+#include "HostAllocator.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+
+static_assert(alignof(std::max_align_t) >= 16, "malloc must align to at least 16 bytes");
+
+static const uint64_t ARENA_LIVE_ONE = uint64_t(1) << 32;
+static const uint64_t ARENA_OFFSET_MASK = ARENA_LIVE_ONE - 1;
+
+/* Round value up to a multiple of alignment (a power of two, as Vulkan guarantees) */
+static size_t alignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static void raisePeak(std::atomic<size_t>& peak, size_t value) {
+    size_t current = peak.load(std::memory_order_relaxed);
+    while (value > current &&
+           !peak.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+}
+
+static const char *getCategoryName(size_t category) {
+    switch (static_cast<HostAllocationCategory>(category)) {
+        case HostAllocationCategory::Instance:    return "instance";
+        case HostAllocationCategory::Device:      return "device";
+        case HostAllocationCategory::Pipeline:    return "pipeline";
+        case HostAllocationCategory::CommandPool: return "command pool";
+        default:                                  return "-";
+    }
+}
+
+static const char *getScopeName(size_t scope) {
+    switch (static_cast<VkSystemAllocationScope>(scope)) {
+        case VK_SYSTEM_ALLOCATION_SCOPE_COMMAND:  return "command";
+        case VK_SYSTEM_ALLOCATION_SCOPE_OBJECT:   return "object";
+        case VK_SYSTEM_ALLOCATION_SCOPE_CACHE:    return "cache";
+        case VK_SYSTEM_ALLOCATION_SCOPE_DEVICE:   return "device";
+        case VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE: return "instance";
+        default:                                  return "-";
+    }
+}
+
+HostAllocator::HostAllocator(size_t limit, size_t frameArenaSize)
+        : limit(limit), arenaSize(std::min<size_t>(frameArenaSize, ARENA_OFFSET_MASK)) {
+    for (size_t i = 0; i < CATEGORY_COUNT; ++i) {
+        Category& category = categories[i];
+        category.owner = this;
+        category.index = static_cast<uint8_t>(i);
+        category.callbacks.pUserData = &category;
+        category.callbacks.pfnAllocation = allocationCallback;
+        category.callbacks.pfnReallocation = reallocationCallback;
+        category.callbacks.pfnFree = freeCallback;
+        category.callbacks.pfnInternalAllocation = internalAllocationCallback;
+        category.callbacks.pfnInternalFree = internalFreeCallback;
+    }
+
+    if (arenaSize != 0) arena = std::make_unique<unsigned char[]>(arenaSize);
+}
+
+HostAllocator::~HostAllocator() {
+    for (void *chunk : chunks) std::free(chunk);
+}
+
+void
+HostAllocator::resetFrameArena() {
+    /* Only rewind while no allocation is live, or a later one could overlap it */
+    uint64_t state = arenaState.load(std::memory_order_relaxed);
+    if ((state >> 32) == 0)
+        arenaState.compare_exchange_strong(state, 0, std::memory_order_acq_rel);
+}
+
+HostMemoryStats
+HostAllocator::getStats(HostAllocationCategory category, VkSystemAllocationScope scope) const {
+    return readCounters(categories[static_cast<size_t>(category)].scopes[scope]);
+}
+
+HostMemoryStats
+HostAllocator::getTotalStats() const {
+    HostMemoryStats total;
+    for (const auto& category : categories)
+        for (const auto& scope : category.scopes) {
+            HostMemoryStats stats = readCounters(scope);
+            total.liveBytes += stats.liveBytes;
+            total.liveAllocations += stats.liveAllocations;
+            total.totalAllocations += stats.totalAllocations;
+        }
+    /* Peaks of different scopes need not coincide, so this one is tracked on its own */
+    total.peakBytes = peakBytes.load(std::memory_order_relaxed);
+
+    return total;
+}
+
+void
+HostAllocator::writeStats(std::ostream& out) const {
+    HostMemoryStats total = getTotalStats();
+    const double KiB = 1024.0;
+
+    out << std::fixed << std::setprecision(1)
+        << "Host memory: " << total.liveBytes / KiB << " KiB live in " << total.liveAllocations
+        << " allocations, " << total.peakBytes / KiB << " KiB peak ("
+        << total.totalAllocations << " made, "
+        << getFailedCount() << " failed";
+    if (limit != 0) out << ", limit " << limit / KiB << " KiB";
+    out << ")\n";
+
+    for (size_t i = 0; i < CATEGORY_COUNT; ++i) {
+        const Category& category = categories[i];
+        for (size_t scope = 0; scope < SCOPE_COUNT; ++scope) {
+            HostMemoryStats stats = readCounters(category.scopes[scope]);
+            if (stats.totalAllocations == 0) continue;
+
+            out << "  " << std::left << std::setw(13) << getCategoryName(i)
+                << std::setw(9) << getScopeName(scope) << std::right
+                << std::setw(10) << stats.liveBytes / KiB << " KiB live"
+                << std::setw(10) << stats.peakBytes / KiB << " KiB peak"
+                << std::setw(10) << stats.totalAllocations << " allocations\n";
+        }
+
+        HostMemoryStats internal = readCounters(category.internal);
+        if (internal.totalAllocations != 0)
+            out << "  " << std::left << std::setw(13) << getCategoryName(i)
+                << std::setw(9) << "internal" << std::right
+                << std::setw(10) << internal.liveBytes / KiB << " KiB live"
+                << std::setw(10) << internal.peakBytes / KiB << " KiB peak"
+                << std::setw(10) << internal.totalAllocations << " allocations\n";
+    }
+
+    out << "  frame arena: " << arenaPeak.load(std::memory_order_relaxed) / KiB << " of "
+        << arenaSize / KiB << " KiB at most, "
+        << arenaOverflowCount.load(std::memory_order_relaxed) << " allocations overflowed\n"
+        << std::defaultfloat;
+}
+
+void *
+HostAllocator::allocate(Category& category, size_t size, size_t alignment,
+                        VkSystemAllocationScope scope) {
+    if (size == 0) return nullptr;
+    if (static_cast<size_t>(scope) >= SCOPE_COUNT) scope = VK_SYSTEM_ALLOCATION_SCOPE_OBJECT;
+
+    /* Blocks start 16-byte aligned, so stricter alignments need padding */
+    alignment = std::max(alignment, alignof(Header));
+    size_t blockSize = sizeof(Header) + size + (alignment - alignof(Header));
+
+    size_t total = liveBytes.fetch_add(size, std::memory_order_relaxed) + size;
+    if (limit != 0 && total > limit) {
+        liveBytes.fetch_sub(size, std::memory_order_relaxed);
+        failedCount.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    raisePeak(peakBytes, total);
+
+    Source source = Source::System;
+    uint8_t sizeClass = 0;
+    void *raw = nullptr;
+    if (scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND) {
+        raw = allocateFromArena(blockSize);
+        source = Source::Arena;
+    }
+    if (raw == nullptr && blockSize <= MAX_POOLED_SIZE) {
+        while ((MIN_POOLED_SIZE << sizeClass) < blockSize) ++sizeClass;
+        raw = allocateFromPool(sizeClass);
+        source = Source::Pool;
+    }
+    if (raw == nullptr) {
+        raw = std::malloc(blockSize);
+        source = Source::System;
+    }
+    if (raw == nullptr) {
+        liveBytes.fetch_sub(size, std::memory_order_relaxed);
+        failedCount.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    auto address = alignUp(reinterpret_cast<uintptr_t>(raw) + sizeof(Header), alignment);
+    Header *header = reinterpret_cast<Header *>(address) - 1;
+    header->raw = raw;
+    header->size = size;
+    header->source = source;
+    header->sizeClass = sizeClass;
+    header->scope = static_cast<uint8_t>(scope);
+    header->category = category.index;
+
+    Counters& counters = category.scopes[scope];
+    raisePeak(counters.peakBytes,
+              counters.liveBytes.fetch_add(size, std::memory_order_relaxed) + size);
+    counters.liveAllocations.fetch_add(1, std::memory_order_relaxed);
+    counters.totalAllocations.fetch_add(1, std::memory_order_relaxed);
+
+    return reinterpret_cast<void *>(address);
+}
+
+void *
+HostAllocator::reallocate(Category& category, void *original, size_t size, size_t alignment,
+                          VkSystemAllocationScope scope) {
+    if (original == nullptr) return allocate(category, size, alignment, scope);
+    if (size == 0) {
+        free(original);
+        return nullptr;
+    }
+
+    /* On failure the original allocation must stay untouched */
+    void *memory = allocate(category, size, alignment, scope);
+    if (memory == nullptr) return nullptr;
+
+    const Header *header = reinterpret_cast<const Header *>(original) - 1;
+    memcpy(memory, original, std::min(header->size, size));
+    free(original);
+
+    return memory;
+}
+
+void
+HostAllocator::free(void *memory) {
+    if (memory == nullptr) return;
+
+    const Header *header = reinterpret_cast<const Header *>(memory) - 1;
+    Counters& counters = categories[header->category].scopes[header->scope];
+    counters.liveBytes.fetch_sub(header->size, std::memory_order_relaxed);
+    counters.liveAllocations.fetch_sub(1, std::memory_order_relaxed);
+    liveBytes.fetch_sub(header->size, std::memory_order_relaxed);
+
+    switch (header->source) {
+        case Source::Arena:
+            /* The space is only reclaimed when the arena is reset. Release, so that whoever
+             * gets the space next sees our writes to it as done */
+            arenaState.fetch_sub(ARENA_LIVE_ONE, std::memory_order_release);
+            break;
+        case Source::Pool:
+            freeToPool(header->raw, header->sizeClass);
+            break;
+        case Source::System:
+            std::free(header->raw);
+            break;
+    }
+}
+
+void *
+HostAllocator::allocateFromArena(size_t size) {
+    size = alignUp(size, alignof(Header));
+
+    uint64_t state = arenaState.load(std::memory_order_relaxed);
+    for (;;) {
+        size_t offset = state & ARENA_OFFSET_MASK;
+        if (offset + size > arenaSize) {
+            arenaOverflowCount.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        if (arenaState.compare_exchange_weak(state, state + ARENA_LIVE_ONE + size,
+                                             std::memory_order_acquire,
+                                             std::memory_order_relaxed)) {
+            raisePeak(arenaPeak, offset + size);
+            return arena.get() + offset;
+        }
+    }
+}
+
+void *
+HostAllocator::allocateFromPool(uint8_t sizeClass) {
+    SizeClass& pool = sizeClasses[sizeClass];
+    std::lock_guard<std::mutex> lock(pool.mutex);
+
+    if (pool.freeList == nullptr) {
+        auto chunk = static_cast<unsigned char *>(std::malloc(CHUNK_SIZE));
+        if (chunk == nullptr) return nullptr;
+        {
+            std::lock_guard<std::mutex> chunkLock(chunkMutex);
+            chunks.push_back(chunk);
+        }
+
+        size_t blockSize = MIN_POOLED_SIZE << sizeClass;
+        for (size_t offset = 0; offset + blockSize <= CHUNK_SIZE; offset += blockSize) {
+            auto block = reinterpret_cast<FreeBlock *>(chunk + offset);
+            block->next = pool.freeList;
+            pool.freeList = block;
+        }
+    }
+
+    FreeBlock *block = pool.freeList;
+    pool.freeList = block->next;
+    return block;
+}
+
+void
+HostAllocator::freeToPool(void *raw, uint8_t sizeClass) {
+    SizeClass& pool = sizeClasses[sizeClass];
+    std::lock_guard<std::mutex> lock(pool.mutex);
+
+    auto block = static_cast<FreeBlock *>(raw);
+    block->next = pool.freeList;
+    pool.freeList = block;
+}
+
+HostMemoryStats
+HostAllocator::readCounters(const Counters& counters) {
+    HostMemoryStats stats;
+    stats.liveBytes = counters.liveBytes.load(std::memory_order_relaxed);
+    stats.peakBytes = counters.peakBytes.load(std::memory_order_relaxed);
+    stats.liveAllocations = counters.liveAllocations.load(std::memory_order_relaxed);
+    stats.totalAllocations = counters.totalAllocations.load(std::memory_order_relaxed);
+    return stats;
+}
+
+VKAPI_ATTR void *VKAPI_CALL
+HostAllocator::allocationCallback(void *userData, size_t size, size_t alignment,
+                                  VkSystemAllocationScope scope) {
+    auto category = static_cast<Category *>(userData);
+    return category->owner->allocate(*category, size, alignment, scope);
+}
+
+VKAPI_ATTR void *VKAPI_CALL
+HostAllocator::reallocationCallback(void *userData, void *original, size_t size,
+                                    size_t alignment, VkSystemAllocationScope scope) {
+    auto category = static_cast<Category *>(userData);
+    return category->owner->reallocate(*category, original, size, alignment, scope);
+}
+
+VKAPI_ATTR void VKAPI_CALL
+HostAllocator::freeCallback(void *userData, void *memory) {
+    static_cast<Category *>(userData)->owner->free(memory);
+}
+
+VKAPI_ATTR void VKAPI_CALL
+HostAllocator::internalAllocationCallback(void *userData, size_t size,
+                                          VkInternalAllocationType type,
+                                          VkSystemAllocationScope scope) {
+    (void) type; (void) scope; /* Unused */
+
+    Counters& counters = static_cast<Category *>(userData)->internal;
+    raisePeak(counters.peakBytes,
+              counters.liveBytes.fetch_add(size, std::memory_order_relaxed) + size);
+    counters.liveAllocations.fetch_add(1, std::memory_order_relaxed);
+    counters.totalAllocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+VKAPI_ATTR void VKAPI_CALL
+HostAllocator::internalFreeCallback(void *userData, size_t size,
+                                    VkInternalAllocationType type,
+                                    VkSystemAllocationScope scope) {
+    (void) type; (void) scope; /* Unused */
+
+    Counters& counters = static_cast<Category *>(userData)->internal;
+    counters.liveBytes.fetch_sub(size, std::memory_order_relaxed);
+    counters.liveAllocations.fetch_sub(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,163 @@
+#ifndef HOST_ALLOCATOR_H
+#define HOST_ALLOCATOR_H
+
+#include "vulkan/vulkan_core.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+/* Kinds of Vulkan objects that get allocation callbacks of their own, so that their host
+ * memory is accounted separately */
+enum class HostAllocationCategory {
+    Instance,    /* The instance, surface and debug messenger */
+    Device,      /* The device and every child object not listed below */
+    Pipeline,    /* Pipelines, pipeline layouts, the pipeline cache and shader modules */
+    CommandPool, /* Command pools, and through them command buffer recording */
+};
+
+/* Host memory use of one category and allocation scope */
+struct HostMemoryStats {
+    size_t liveBytes = 0;
+    size_t peakBytes = 0;
+    size_t liveAllocations = 0;
+    uint64_t totalAllocations = 0; /* Allocations made so far, freed ones included */
+};
+
+/* Serves the host memory the driver asks for through VkAllocationCallbacks, instead of leaving
+ * it to the driver's own malloc.
+ *
+ * Small allocations come from size-class pools, each with a free list of its own, so threads
+ * recording in parallel rarely contend for the same lock. Command-scope allocations (which only
+ * live for the duration of one Vulkan call) are bumped off a lock-free arena that is reset once
+ * per frame, falling back to the pools when it is full. Anything larger goes to malloc.
+ *
+ * Live and peak bytes are tracked per category and scope. With a limit, allocations that would
+ * take the live total over it fail, which the driver reports as VK_ERROR_OUT_OF_HOST_MEMORY.
+ * All functions are thread safe. Every object must be destroyed before the allocator. */
+class HostAllocator {
+    public:
+        /* limit caps the bytes live at once over all categories; 0 = no limit */
+        explicit HostAllocator(size_t limit = 0, size_t frameArenaSize = DEFAULT_FRAME_ARENA_SIZE);
+        ~HostAllocator();
+
+        HostAllocator(const HostAllocator&) = delete;
+        HostAllocator& operator=(const HostAllocator&) = delete;
+
+        /* To pass as pAllocator when creating and destroying objects of a category */
+        const VkAllocationCallbacks *getCallbacks(HostAllocationCategory category) const {
+            return &categories[static_cast<size_t>(category)].callbacks;
+        }
+
+        /* Start the frame arena over, unless a Vulkan call is still using it */
+        void resetFrameArena();
+
+        HostMemoryStats getStats(HostAllocationCategory category,
+                                 VkSystemAllocationScope scope) const;
+        /* Summed over every category and scope */
+        HostMemoryStats getTotalStats() const;
+        /* Allocations refused because of the limit, or because malloc failed */
+        uint64_t getFailedCount() const { return failedCount.load(std::memory_order_relaxed); }
+        /* Print usage per category and scope */
+        void writeStats(std::ostream& out) const;
+
+        static const size_t DEFAULT_FRAME_ARENA_SIZE = 1 << 20;
+
+    private:
+        /* Size classes are powers of two from MIN_POOLED_SIZE to MAX_POOLED_SIZE, header
+         * and alignment padding included */
+        static const size_t MIN_POOLED_SIZE = 64;
+        static const size_t MAX_POOLED_SIZE = 4096;
+        static const size_t SIZE_CLASS_COUNT = 7;
+        /* Pools grow by this much at a time */
+        static const size_t CHUNK_SIZE = 64 << 10;
+        /* VK_SYSTEM_ALLOCATION_SCOPE_COMMAND through VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE */
+        static const size_t SCOPE_COUNT = 5;
+        static const size_t CATEGORY_COUNT = 4;
+
+        enum class Source : uint8_t { Arena, Pool, System };
+
+        /* Stored right before every allocation handed out */
+        struct alignas(16) Header {
+            void *raw;     /* Start of the block the allocation was carved from */
+            size_t size;   /* Bytes requested */
+            Source source;
+            uint8_t sizeClass;
+            uint8_t scope;
+            uint8_t category;
+        };
+
+        struct Counters {
+            std::atomic<size_t> liveBytes { 0 };
+            std::atomic<size_t> peakBytes { 0 };
+            std::atomic<size_t> liveAllocations { 0 };
+            std::atomic<uint64_t> totalAllocations { 0 };
+        };
+
+        struct Category {
+            HostAllocator *owner = nullptr;
+            uint8_t index = 0;
+            VkAllocationCallbacks callbacks {};
+            Counters scopes[SCOPE_COUNT];
+            Counters internal; /* Allocations the driver made itself and only reported */
+        };
+
+        /* A pooled block on a free list */
+        struct FreeBlock {
+            FreeBlock *next;
+        };
+        struct SizeClass {
+            std::mutex mutex;
+            FreeBlock *freeList = nullptr;
+        };
+
+        size_t limit;
+        std::atomic<size_t> liveBytes { 0 }; /* Over all categories, for the limit */
+        std::atomic<size_t> peakBytes { 0 };
+        std::atomic<uint64_t> failedCount { 0 };
+
+        Category categories[CATEGORY_COUNT];
+
+        SizeClass sizeClasses[SIZE_CLASS_COUNT];
+        std::mutex chunkMutex;
+        std::vector<void *> chunks; /* Backing memory of the pools, freed with the allocator */
+
+        /* The frame arena. Its state packs the number of live allocations in the upper 32 bits
+         * and the bump offset in the lower 32, so both change in one atomic operation */
+        std::unique_ptr<unsigned char[]> arena;
+        size_t arenaSize;
+        std::atomic<uint64_t> arenaState { 0 };
+        std::atomic<size_t> arenaPeak { 0 };
+        std::atomic<uint64_t> arenaOverflowCount { 0 };
+
+        void *allocate(Category& category, size_t size, size_t alignment,
+                       VkSystemAllocationScope scope);
+        void *reallocate(Category& category, void *original, size_t size, size_t alignment,
+                         VkSystemAllocationScope scope);
+        void free(void *memory);
+
+        void *allocateFromArena(size_t size);
+        void *allocateFromPool(uint8_t sizeClass);
+        void freeToPool(void *raw, uint8_t sizeClass);
+
+        static HostMemoryStats readCounters(const Counters& counters);
+
+        static VKAPI_ATTR void *VKAPI_CALL allocationCallback(
+                void *userData, size_t size, size_t alignment, VkSystemAllocationScope scope);
+        static VKAPI_ATTR void *VKAPI_CALL reallocationCallback(
+                void *userData, void *original, size_t size, size_t alignment,
+                VkSystemAllocationScope scope);
+        static VKAPI_ATTR void VKAPI_CALL freeCallback(void *userData, void *memory);
+        static VKAPI_ATTR void VKAPI_CALL internalAllocationCallback(
+                void *userData, size_t size, VkInternalAllocationType type,
+                VkSystemAllocationScope scope);
+        static VKAPI_ATTR void VKAPI_CALL internalFreeCallback(
+                void *userData, size_t size, VkInternalAllocationType type,
+                VkSystemAllocationScope scope);
+};
+
+#endif
@@ -0,0 +1,182 @@
+#include "JobSystem.hpp"
+
+#include <algorithm>
+
+/* The job system the calling thread works for, and its index there */
+static thread_local const JobSystem *threadJobSystem = nullptr;
+static thread_local size_t threadIndex = 0;
+
+JobSystem::JobSystem(size_t threadCount) {
+    if (threadCount == 0)
+        threadCount = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+    for (size_t i = 0; i < threadCount; ++i)
+        queues.push_back(std::make_unique<Queue>());
+
+    /* The owning thread runs jobs too, so it takes the place of one worker */
+    size_t workerCount = threadCount - 1;
+
+    workers.reserve(workerCount);
+    for (size_t i = 0; i < workerCount; ++i)
+        workers.emplace_back(&JobSystem::workerLoop, this, i);
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+
+    for (auto& worker : workers)
+        worker.join();
+}
+
+size_t
+JobSystem::currentThread() const {
+    return threadJobSystem == this ? threadIndex : queues.size() - 1;
+}
+
+void
+JobSystem::submit(JobCounter& counter, Job job) {
+    counter.pending.fetch_add(1, std::memory_order_relaxed);
+
+    Queue& queue = *queues[currentThread()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back({ std::move(job), &counter });
+    }
+    queuedTasks.fetch_add(1, std::memory_order_release);
+
+    /* Taking the lock orders us after any sleeper's check of queuedTasks */
+    { std::lock_guard<std::mutex> lock(sleepMutex); }
+    wakeUp.notify_one();
+}
+
+void
+JobSystem::wait(JobCounter& counter) {
+    waitUntil(counter, [] { return false; });
+}
+
+bool
+JobSystem::waitUntil(JobCounter& counter, const std::function<bool()>& interrupted) {
+    size_t thread = currentThread();
+
+    /* Help out instead of idling; someone else may be running the last jobs, though */
+    while (counter.pending.load(std::memory_order_acquire) > 0) {
+        if (interrupted()) return false;
+
+        Task task;
+        if (takeTask(thread, task)) {
+            runTask(thread, task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeUp.wait(lock, [&] {
+            return counter.pending.load(std::memory_order_acquire) == 0 ||
+                   queuedTasks.load(std::memory_order_acquire) > 0 || interrupted();
+        });
+    }
+
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(counter.errorMutex);
+        std::swap(error, counter.error);
+    }
+    if (error) std::rethrow_exception(error);
+    return true;
+}
+
+void
+JobSystem::notifyWaiters() {
+    /* Taking the lock orders us after any sleeper's check of its condition */
+    { std::lock_guard<std::mutex> lock(sleepMutex); }
+    wakeUp.notify_all();
+}
+
+void
+JobSystem::parallelFor(size_t count, size_t grain,
+                       const std::function<void(size_t begin, size_t end, size_t thread)>& fn) {
+    if (count == 0) return;
+
+    /* No more chunks than threads, and none smaller than the grain */
+    grain = std::max<size_t>(grain, 1);
+    size_t chunks = std::min((count + grain - 1) / grain, getThreadCount());
+    size_t chunkSize = (count + chunks - 1) / chunks;
+
+    JobCounter counter;
+    for (size_t begin = 0; begin < count; begin += chunkSize) {
+        size_t end = std::min(begin + chunkSize, count);
+        submit(counter, [&fn, begin, end](size_t thread) { fn(begin, end, thread); });
+    }
+
+    wait(counter);
+}
+
+bool
+JobSystem::takeTask(size_t thread, Task& task) {
+    if (queuedTasks.load(std::memory_order_acquire) == 0) return false;
+
+    /* Newest first from our own queue, while it is still warm in cache */
+    {
+        Queue& queue = *queues[thread];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            queuedTasks.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    /* Oldest first from everyone else, as those tend to be the largest pieces of work */
+    for (size_t offset = 1; offset < queues.size(); ++offset) {
+        Queue& queue = *queues[(thread + offset) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            queuedTasks.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void
+JobSystem::runTask(size_t thread, Task& task) {
+    try {
+        task.job(thread);
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(task.counter->errorMutex);
+        if (!task.counter->error) task.counter->error = std::current_exception();
+    }
+
+    /* The last job of a batch wakes whoever waits on it */
+    if (task.counter->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        { std::lock_guard<std::mutex> lock(sleepMutex); }
+        wakeUp.notify_all();
+    }
+}
+
+void
+JobSystem::workerLoop(size_t thread) {
+    threadJobSystem = this;
+    threadIndex = thread;
+
+    while (true) {
+        Task task;
+        if (takeTask(thread, task)) {
+            runTask(thread, task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeUp.wait(lock, [this] {
+            return stopping || queuedTasks.load(std::memory_order_acquire) > 0;
+        });
+        if (stopping && queuedTasks.load(std::memory_order_acquire) == 0) return;
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Tracks a batch of submitted jobs so their submitter can wait for them */
+struct JobCounter {
+    std::atomic<size_t> pending { 0 };
+    std::mutex errorMutex;
+    std::exception_ptr error; /* The first exception thrown by a job of the batch */
+};
+
+/* Pool of worker threads sharing jobs by work stealing.
+ * Every thread has its own queue: it pops its newest jobs and, when out of work, steals the
+ * oldest jobs of other threads. The thread that owns the job system takes part as well while
+ * it waits, using the last thread index, so there are getThreadCount() indices in total.
+ * Only the owning thread and jobs themselves may submit or wait. */
+class JobSystem {
+    public:
+        /* A job is handed the index of the thread running it, for per-thread resources */
+        using Job = std::function<void(size_t thread)>;
+
+        /* Run jobs on threadCount threads, the owning one included; 0 = one per hardware thread */
+        explicit JobSystem(size_t threadCount = 0);
+        ~JobSystem();
+
+        JobSystem(const JobSystem&) = delete;
+        JobSystem& operator=(const JobSystem&) = delete;
+
+        /* Number of distinct thread indices jobs can see, including the owning thread */
+        size_t getThreadCount() const { return queues.size(); }
+
+        /* Queue a job on the calling thread's queue */
+        void submit(JobCounter& counter, Job job);
+        /* Run jobs until every job of the counter is done, then rethrow its first error */
+        void wait(JobCounter& counter);
+        /* Like wait(), but return false early (without rethrowing) as soon as interrupted()
+         * holds; whatever makes it hold must call notifyWaiters() afterwards. A job already
+         * being run by the waiting thread is finished first */
+        bool waitUntil(JobCounter& counter, const std::function<bool()>& interrupted);
+        /* Wake threads waiting in waitUntil() to check their condition again */
+        void notifyWaiters();
+        /* Split [0, count) into chunks of at least grain items and run fn(begin, end, thread)
+         * on each, returning once all are done */
+        void parallelFor(size_t count, size_t grain,
+                         const std::function<void(size_t begin, size_t end, size_t thread)>& fn);
+
+    private:
+        struct Task {
+            Job job;
+            JobCounter *counter;
+        };
+        /* A thread's queue; the owner works at the back, thieves take from the front */
+        struct Queue {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        std::vector<std::unique_ptr<Queue>> queues; /* One per worker, plus the owner's last */
+        std::vector<std::thread> workers;
+
+        std::atomic<size_t> queuedTasks { 0 }; /* Tasks sitting in any queue */
+        std::atomic<bool> stopping { false };
+        std::mutex sleepMutex;
+        std::condition_variable wakeUp;
+
+        /* Index of the calling thread within this job system */
+        size_t currentThread() const;
+        /* Take a task from our own queue, or else steal one; false if every queue is empty */
+        bool takeTask(size_t thread, Task& task);
+        /* Run a task and mark it done */
+        void runTask(size_t thread, Task& task);
+        void workerLoop(size_t thread);
+};
+
+#endif
@@ -0,0 +1,95 @@
+#include "PipelineRegistry.hpp"
+
+#include <utility>
+
+uint64_t
+PipelineVariant::getKey() const {
+    /* Every field gets bits of its own: topology 4, cull mode 2, blend 2, samples 7 (one bit
+     * per count), then the specialization constants a byte each */
+    return uint64_t(topology & 0xf) |
+           uint64_t(cullMode & 0x3) << 4 |
+           uint64_t(static_cast<uint8_t>(blend) & 0x3) << 6 |
+           uint64_t(samples & 0x7f) << 8 |
+           uint64_t(colorMode) << 16 |
+           uint64_t(alpha) << 24;
+}
+
+PipelineRegistry::PipelineRegistry(VkDevice device, Builder builder,
+                                   const VkAllocationCallbacks *allocator)
+        : device(device), builder(std::move(builder)), allocator(allocator) {}
+
+PipelineRegistry::~PipelineRegistry() {
+    for (auto pipeline : takeAll())
+        vkDestroyPipeline(device, pipeline, allocator);
+}
+
+VkPipeline
+PipelineRegistry::get(const PipelineVariant& variant) {
+    uint64_t key = variant.getKey();
+    std::shared_future<VkPipeline> existing;
+    std::promise<VkPipeline> promise;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = pipelines.find(key);
+        if (it != pipelines.end())
+            existing = it->second;
+        else
+            pipelines.emplace(key, promise.get_future().share());
+    }
+    /* Waits if another thread is still building it */
+    if (existing.valid()) return existing.get();
+
+    /* Build outside the lock, so different variants can be built at the same time. A failed
+     * build stays in the map and rethrows for everyone asking for it */
+    try {
+        VkPipeline pipeline = builder(variant);
+        promise.set_value(pipeline);
+        return pipeline;
+    } catch (...) {
+        promise.set_exception(std::current_exception());
+        throw;
+    }
+}
+
+void
+PipelineRegistry::prewarm(std::vector<PipelineVariant> variants) {
+    prewarmThreads.emplace_back([this, variants = std::move(variants)] {
+        for (const auto& variant : variants) {
+            if (stopPrewarming.load(std::memory_order_relaxed)) return;
+            /* Errors resurface when the variant is actually asked for */
+            try { get(variant); } catch (...) {}
+        }
+    });
+}
+
+std::vector<VkPipeline>
+PipelineRegistry::takeAll() {
+    cancelPrewarm();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<VkPipeline> result;
+    for (auto& entry : pipelines) {
+        /* With the prewarm threads gone, only a concurrent get() could still be building */
+        try {
+            VkPipeline pipeline = entry.second.get();
+            if (pipeline != VK_NULL_HANDLE) result.push_back(pipeline);
+        } catch (...) {}
+    }
+    pipelines.clear();
+    return result;
+}
+
+size_t
+PipelineRegistry::getVariantCount() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return pipelines.size();
+}
+
+void
+PipelineRegistry::cancelPrewarm() {
+    stopPrewarming.store(true, std::memory_order_relaxed);
+    for (auto& thread : prewarmThreads)
+        thread.join();
+    prewarmThreads.clear();
+    stopPrewarming.store(false, std::memory_order_relaxed);
+}
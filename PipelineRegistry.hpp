@@ -0,0 +1,79 @@
+#ifndef PIPELINE_REGISTRY_H
+#define PIPELINE_REGISTRY_H
+
+#include "vulkan/vulkan_core.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/* How a pipeline variant blends its output with the framebuffer */
+enum class BlendMode : uint8_t {
+    Opaque,   /* Overwrite */
+    Alpha,    /* Mix by source alpha */
+    Additive, /* Add, weighted by source alpha */
+};
+
+/* Everything a graphics pipeline variant is built from besides the shared shaders and layout */
+struct PipelineVariant {
+    VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+    BlendMode blend = BlendMode::Opaque;
+    VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+    /* Specialization constants of the fragment shader */
+    uint8_t colorMode = 0; /* 0 = vertex colors, 1 = grayscale, 2 = inverted */
+    uint8_t alpha = 255;   /* Output alpha, in 255ths */
+
+    /* Pack the variant into a key unique to it */
+    uint64_t getKey() const;
+};
+
+/* Builds graphics pipeline variants on first use and keeps them, looked up by their packed key.
+ * Variants can also be built ahead of time on a background thread; asking for a variant that
+ * is still being built waits for it rather than building it twice. get() may be called from
+ * any thread; the other functions only from the thread owning the registry. */
+class PipelineRegistry {
+    public:
+        /* Creates the pipeline of a variant; called from any thread, without locks held */
+        using Builder = std::function<VkPipeline(const PipelineVariant& variant)>;
+
+        /* allocator must be the one the builder creates pipelines with */
+        PipelineRegistry(VkDevice device, Builder builder,
+                         const VkAllocationCallbacks *allocator = nullptr);
+        ~PipelineRegistry();
+
+        PipelineRegistry(const PipelineRegistry&) = delete;
+        PipelineRegistry& operator=(const PipelineRegistry&) = delete;
+
+        /* The pipeline of a variant, building it now if nobody has yet */
+        VkPipeline get(const PipelineVariant& variant);
+        /* Start building variants on a background thread */
+        void prewarm(std::vector<PipelineVariant> variants);
+        /* Let prewarm threads finish the variant they are building, skip the rest, and wait
+         * for them; builders may then rely on state that prewarming would have read */
+        void cancelPrewarm();
+        /* Stop prewarming and hand over every pipeline built so far, leaving the registry
+         * empty; the caller becomes responsible for destroying them */
+        std::vector<VkPipeline> takeAll();
+
+        /* Number of variants built or being built */
+        size_t getVariantCount() const;
+
+    private:
+        VkDevice device;
+        Builder builder;
+        const VkAllocationCallbacks *allocator;
+
+        mutable std::mutex mutex;
+        std::unordered_map<uint64_t, std::shared_future<VkPipeline>> pipelines;
+
+        std::vector<std::thread> prewarmThreads;
+        std::atomic<bool> stopPrewarming { false };
+};
+
+#endif
@@ -0,0 +1,78 @@
+#include "ShaderBinary.hpp"
+
+#include <stdexcept>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+ShaderBinary::~ShaderBinary() {
+    release();
+}
+
+ShaderBinary::ShaderBinary(ShaderBinary&& other) noexcept
+        : code(std::exchange(other.code, nullptr)), size(std::exchange(other.size, 0)),
+          mapped(std::exchange(other.mapped, false)) {}
+
+ShaderBinary&
+ShaderBinary::operator=(ShaderBinary&& other) noexcept {
+    if (this != &other) {
+        release();
+        code = std::exchange(other.code, nullptr);
+        size = std::exchange(other.size, 0);
+        mapped = std::exchange(other.mapped, false);
+    }
+    return *this;
+}
+
+ShaderBinary
+ShaderBinary::fromMemory(const uint32_t *code, size_t size) {
+    ShaderBinary binary;
+    binary.code = code;
+    binary.size = size;
+    binary.validate("embedded shader");
+    return binary;
+}
+
+ShaderBinary
+ShaderBinary::fromFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("Failed to open shader " + path + ".");
+
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size == 0) {
+        close(fd);
+        throw std::runtime_error("Failed to read shader " + path + ".");
+    }
+
+    /* The mapping outlives the descriptor, and the pages are only read in as the driver
+     * parses the code */
+    void *data = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        throw std::runtime_error("Failed to map shader " + path + ".");
+
+    ShaderBinary binary;
+    binary.code = static_cast<const uint32_t *>(data);
+    binary.size = static_cast<size_t>(status.st_size);
+    binary.mapped = true;
+    binary.validate(path); /* Unmaps on throw, through the destructor */
+    return binary;
+}
+
+void
+ShaderBinary::validate(const std::string& name) const {
+    if (size < sizeof(uint32_t) || size % sizeof(uint32_t) != 0 || code[0] != SPIRV_MAGIC)
+        throw std::runtime_error("Failed to load shader " + name + ": not a SPIR-V module.");
+}
+
+void
+ShaderBinary::release() {
+    if (mapped) munmap(const_cast<uint32_t *>(code), size);
+    code = nullptr;
+    size = 0;
+    mapped = false;
+}
@@ -0,0 +1,43 @@
+#ifndef SHADER_BINARY_H
+#define SHADER_BINARY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/* SPIR-V code ready to be handed to vkCreateShaderModule, without copying it around: either
+ * an array compiled into the program, or a file mapped into memory (which is page aligned,
+ * unlike a std::vector<char> read from a stream). */
+class ShaderBinary {
+    public:
+        ShaderBinary() = default;
+        ~ShaderBinary();
+
+        ShaderBinary(ShaderBinary&& other) noexcept;
+        ShaderBinary& operator=(ShaderBinary&& other) noexcept;
+        ShaderBinary(const ShaderBinary&) = delete;
+        ShaderBinary& operator=(const ShaderBinary&) = delete;
+
+        /* Refer to code compiled into the program; size is in bytes */
+        static ShaderBinary fromMemory(const uint32_t *code, size_t size);
+        /* Map a .spv file into memory; throws if it can't be read or isn't SPIR-V */
+        static ShaderBinary fromFile(const std::string& path);
+
+        const uint32_t *getCode() const { return code; }
+        /* Size of the code in bytes, as vkCreateShaderModule wants it */
+        size_t getSize() const { return size; }
+
+        /* First word of every SPIR-V module */
+        static const uint32_t SPIRV_MAGIC = 0x07230203;
+
+    private:
+        const uint32_t *code = nullptr;
+        size_t size = 0;
+        bool mapped = false; /* Whether code is a mapping to be undone on destruction */
+
+        /* Check that the code looks like a SPIR-V module */
+        void validate(const std::string& name) const;
+        void release();
+};
+
+#endif
@@ -0,0 +1,55 @@
+#include "StagingRing.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+StagingRing::StagingRing(VkDevice device, DeviceAllocator& allocator, VkDeviceSize size,
+                         const VkAllocationCallbacks *callbacks)
+        : device(device), allocator(allocator), size(size), callbacks(callbacks) {
+    VkBufferCreateInfo bufferInfo {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if (vkCreateBuffer(device, &bufferInfo, callbacks, &buffer) != VK_SUCCESS)
+        throw std::runtime_error("Failed to create staging ring buffer.");
+
+    /* Coherent memory, so writes never have to be flushed */
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+    memory = allocator.allocate(memRequirements,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    vkBindBufferMemory(device, buffer, memory.memory, memory.offset);
+}
+
+StagingRing::~StagingRing() {
+    vkDestroyBuffer(device, buffer, callbacks);
+    allocator.free(memory);
+}
+
+bool
+StagingRing::allocate(VkDeviceSize bytes, VkDeviceSize alignment,
+                      VkDeviceSize& offset, void *&data) {
+    if (bytes > size)
+        throw std::runtime_error("Failed to stage upload: larger than the staging ring.");
+
+    alignment = std::max<VkDeviceSize>(alignment, 1);
+    uint64_t start = (head + alignment - 1) / alignment * alignment;
+
+    /* Allocations never wrap around the end of the buffer; skip to the start instead */
+    if (start % size + bytes > size)
+        start = (start / size + 1) * size;
+
+    if (start + bytes - tail > size) return false;
+
+    head = start + bytes;
+    offset = start % size;
+    data = static_cast<char*>(memory.mapped) + offset;
+    return true;
+}
+
+void
+StagingRing::release(uint64_t position) {
+    tail = std::max(tail, position);
+}
@@ -0,0 +1,51 @@
+#ifndef STAGING_RING_H
+#define STAGING_RING_H
+
+#include "DeviceAllocator.hpp"
+#include "vulkan/vulkan_core.h"
+
+#include <cstdint>
+
+/* A persistently mapped, host-visible buffer that upload data is staged in on its way to
+ * device-local memory. Space is handed out in order and given back in the same order once the
+ * copies reading it have finished.
+ * Positions only ever grow; a position modulo the ring size is an offset into the buffer. */
+class StagingRing {
+    public:
+        /* callbacks is passed to Vulkan when creating and destroying the buffer */
+        StagingRing(VkDevice device, DeviceAllocator& allocator, VkDeviceSize size,
+                    const VkAllocationCallbacks *callbacks = nullptr);
+        ~StagingRing();
+
+        StagingRing(const StagingRing&) = delete;
+        StagingRing& operator=(const StagingRing&) = delete;
+
+        /* Reserve size bytes, returning their offset into the buffer and their host address.
+         * Returns false if there's no room until earlier uploads are released */
+        bool allocate(VkDeviceSize size, VkDeviceSize alignment,
+                      VkDeviceSize& offset, void *&data);
+        /* Give back everything allocated before a position obtained from getHead() */
+        void release(uint64_t position);
+
+        /* Position right after the most recent allocation */
+        uint64_t getHead() const { return head; }
+        /* Whether nothing is allocated at all */
+        bool isEmpty() const { return head == tail; }
+
+        VkBuffer getBuffer() const { return buffer; }
+        VkDeviceSize getSize() const { return size; }
+
+    private:
+        VkDevice device;
+        DeviceAllocator& allocator;
+        VkDeviceSize size;
+        const VkAllocationCallbacks *callbacks;
+
+        VkBuffer buffer;
+        DeviceAllocation memory;
+
+        uint64_t head = 0; /* Where the next allocation starts */
+        uint64_t tail = 0; /* Start of the oldest allocation still in use */
+};
+
+#endif
@@ -0,0 +1,273 @@
+#include "HelloTriangle.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/* Frames excluded from percentiles while caches and clocks settle */
+static const uint64_t WARMUP_FRAMES = 20;
+/* Pipeline cache of the cache scenarios, apart from the one the program itself keeps */
+static const char *BENCH_PIPELINE_CACHE = "build/bench_pipeline.cache";
+/* Instance counts the stress mode steps through, each a draw of that many triangles */
+static const uint32_t STRESS_INSTANCE_COUNTS[] = {
+    1 << 10, 1 << 13, 1 << 16, 1 << 18, 1 << 20, 1 << 22,
+};
+
+/* A named tweak of the default configuration */
+struct Scenario {
+    std::string name;
+    bool needsWindow; /* Present modes only mean something with a swap chain */
+    std::function<void(AppConfig&)> apply;
+};
+
+static const char *presentModeName(VkPresentModeKHR mode) {
+    switch (mode) {
+        case VK_PRESENT_MODE_IMMEDIATE_KHR:    return "immediate";
+        case VK_PRESENT_MODE_MAILBOX_KHR:      return "mailbox";
+        case VK_PRESENT_MODE_FIFO_KHR:         return "fifo";
+        case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo_relaxed";
+        default:                               return "other";
+    }
+}
+
+static void writeSummary(std::ostream& out, const TimingSummary& summary) {
+    out << "{ \"p50\": " << summary.p50
+        << ", \"p95\": " << summary.p95
+        << ", \"p99\": " << summary.p99
+        << ", \"mean\": " << summary.mean
+        << ", \"max\": " << summary.max << " }";
+}
+
+/* Run a single scenario and append its results to out as a JSON object */
+static void runScenario(std::ostream& out, const Scenario& scenario, AppConfig config) {
+    scenario.apply(config);
+
+    auto initStart = std::chrono::steady_clock::now();
+    HelloTriangleApplication app(config);
+    double initMs = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - initStart).count();
+
+    auto runStart = std::chrono::steady_clock::now();
+    std::clock_t cpuStart = std::clock();
+    app.run();
+    double cpuSeconds = double(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+    double runSeconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - runStart).count();
+
+    /* Percentiles only cover frames after warm-up */
+    std::vector<double> cpuSamples;
+    std::vector<double> gpuSamples;
+    std::vector<double> recordSamples;
+    for (const auto& timing : app.getFrameStats().snapshot())
+        if (timing.frame >= WARMUP_FRAMES) {
+            cpuSamples.push_back(timing.cpuFrameMs);
+            gpuSamples.push_back(timing.gpuMs);
+            recordSamples.push_back(timing.recordMs);
+        }
+
+    out << "    {\n"
+        << "      \"name\": \"" << scenario.name << "\",\n"
+        << "      \"frames\": " << config.frameCount << ",\n"
+        << "      \"frames_in_flight\": " << config.framesInFlight << ",\n"
+        << "      \"draws_per_frame\": " << config.drawCount << ",\n"
+        << "      \"instances_per_draw\": " << config.instanceCount << ",\n"
+        << "      \"present_mode\": \""
+        << (config.headless ? "none" : presentModeName(app.getPresentMode())) << "\",\n"
+        << "      \"fps\": " << config.frameCount / runSeconds << ",\n"
+        /* Cores kept busy on average, over every thread of the process */
+        << "      \"cpu_utilization\": " << cpuSeconds / runSeconds << ",\n"
+        << "      \"vertices_per_second\": "
+        << config.frameCount * app.getVerticesPerFrame() / runSeconds << ",\n"
+        << "      \"cpu_frame_ms\": ";
+    writeSummary(out, FrameStats::summarize(cpuSamples));
+    out << ",\n      \"gpu_ms\": ";
+    writeSummary(out, FrameStats::summarize(gpuSamples));
+    /* Pre-recorded command buffers cost nothing per frame, only in createCommandBuffers */
+    out << ",\n      \"record_ms\": ";
+    writeSummary(out, FrameStats::summarize(recordSamples));
+    DeviceAllocatorStats memory = app.getMemoryStats();
+    out << ",\n      \"device_memory\": { \"blocks\": " << memory.blockCount
+        << ", \"reserved_bytes\": " << memory.reservedBytes
+        << ", \"used_bytes\": " << memory.usedBytes
+        << ", \"fragmentation\": " << memory.fragmentation
+        << ", \"arena_peak_bytes\": " << memory.arenaPeakBytes << " }";
+    if (const FramePacer *pacer = app.getFramePacer())
+        out << ",\n      \"pacing\": { \"target_fps\": " << pacer->getTargetFps()
+            << ", \"missed_deadlines\": " << pacer->getMissedCount()
+            << ", \"predicted_frame_ms\": " << pacer->getPredictedFrameMs() << " }";
+    if (config.hostAllocator) {
+        HostMemoryStats host = app.getHostMemoryStats();
+        out << ",\n      \"host_memory\": { \"live_bytes\": " << host.liveBytes
+            << ", \"peak_bytes\": " << host.peakBytes
+            << ", \"allocations\": " << host.totalAllocations << " }";
+    }
+    out << ",\n      \"init_ms\": " << initMs << ",\n"
+        << "      \"init_steps_ms\": {";
+
+    const auto& steps = app.getInitTimings();
+    for (size_t i = 0; i < steps.size(); ++i)
+        out << (i == 0 ? " " : ", ") << '"' << steps[i].first << "\": " << steps[i].second;
+    out << " }\n    }";
+}
+
+static void printUsage(const char *program) {
+    std::cerr
+        << "Usage: " << program << " [options]\n"
+        << "  --headless       Run every scenario offscreen (skips present mode scenarios)\n"
+        << "  --frames <n>     Frames rendered per scenario (default 500)\n"
+        << "  --stress         Scale the instance count up instead of running the usual scenarios\n"
+        << "  --output <path>  Write JSON results to path instead of stdout\n"
+        << std::endl;
+}
+
+int main(int argc, char **argv) {
+    AppConfig baseConfig;
+    baseConfig.frameCount = 500;
+    /* Every scenario builds its pipelines from scratch, whatever ran before it; only the
+     * cache scenarios below use a cache */
+    baseConfig.pipelineCachePath.clear();
+    std::string outputPath;
+    bool stress = false;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--headless") == 0)
+            baseConfig.headless = true;
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            baseConfig.frameCount = std::strtoull(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--stress") == 0)
+            stress = true;
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            outputPath = argv[++i];
+        else {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::vector<Scenario> scenarios = {
+        { "triangle", false, [](AppConfig&) {} },
+        { "many_draws", false, [](AppConfig& c) { c.drawCount = 1000; } },
+        { "many_instances", false, [](AppConfig& c) { c.instanceCount = 100000; } },
+        { "animated_instances", false,
+            [](AppConfig& c) { c.instanceCount = 100000; c.animateInstances = true; } },
+        { "alpha_blend", false, [](AppConfig& c) {
+            c.instanceCount = 100000;
+            c.pipelineVariant.blend = BlendMode::Alpha;
+            c.pipelineVariant.alpha = 128;
+        } },
+        { "msaa_4x", false, [](AppConfig& c) {
+            c.instanceCount = 100000;
+            c.pipelineVariant.samples = VK_SAMPLE_COUNT_4_BIT;
+        } },
+        /* The render pass and framebuffers, against dynamic rendering where the device has it */
+        { "render_pass_msaa_4x", false, [](AppConfig& c) {
+            c.instanceCount = 100000;
+            c.pipelineVariant.samples = VK_SAMPLE_COUNT_4_BIT;
+            c.allowDynamicRendering = false;
+        } },
+        { "huge_draws", false, [](AppConfig& c) { c.drawCount = 50000; } },
+        { "huge_draws_serial", false,
+            [](AppConfig& c) { c.drawCount = 50000; c.recordThreads = 1; } },
+        { "render_pass_huge_draws", false,
+            [](AppConfig& c) { c.drawCount = 50000; c.allowDynamicRendering = false; } },
+        /* Same scenes recorded anew every frame, against the pre-recorded ones above */
+        { "rerecord_many_draws", false,
+            [](AppConfig& c) { c.drawCount = 1000; c.rerecordCommandBuffers = true; } },
+        { "rerecord_huge_draws", false,
+            [](AppConfig& c) { c.drawCount = 50000; c.rerecordCommandBuffers = true; } },
+        /* The driver's host memory from our pools and frame arena instead of its malloc */
+        { "host_allocator_huge_draws", false, [](AppConfig& c) {
+            c.drawCount = 50000;
+            c.rerecordCommandBuffers = true;
+            c.hostAllocator = true;
+        } },
+        { "gpu_driven_instances", false,
+            [](AppConfig& c) { c.instanceCount = 100000; c.gpuDriven = true; } },
+        { "gpu_driven_animated_instances", false, [](AppConfig& c) {
+            c.instanceCount = 100000;
+            c.animateInstances = true;
+            c.gpuDriven = true;
+        } },
+        /* Draws culled into the frame arenas instead of per-image buffers */
+        { "gpu_driven_rerecord", false, [](AppConfig& c) {
+            c.instanceCount = 100000;
+            c.gpuDriven = true;
+            c.rerecordCommandBuffers = true;
+        } },
+        /* Init with an empty pipeline cache, then with the one that run left behind */
+        { "pipeline_cache_cold", false, [](AppConfig& c) {
+            std::remove(BENCH_PIPELINE_CACHE);
+            c.pipelineCachePath = BENCH_PIPELINE_CACHE;
+        } },
+        { "pipeline_cache_warm", false,
+            [](AppConfig& c) { c.pipelineCachePath = BENCH_PIPELINE_CACHE; } },
+        { "frames_in_flight_1", false, [](AppConfig& c) { c.framesInFlight = 1; } },
+        { "frames_in_flight_3", false, [](AppConfig& c) { c.framesInFlight = 3; } },
+        { "fence_pacing", false, [](AppConfig& c) { c.allowTimelineSemaphore = false; } },
+        { "present_fifo", true,
+            [](AppConfig& c) { c.presentMode = VK_PRESENT_MODE_FIFO_KHR; } },
+        { "present_mailbox", true,
+            [](AppConfig& c) { c.presentMode = VK_PRESENT_MODE_MAILBOX_KHR; } },
+        { "present_immediate", true,
+            [](AppConfig& c) { c.presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR; } },
+        /* Frames held to a fixed rate, against drawing as many as the present mode takes */
+        { "paced_60fps", false, [](AppConfig& c) { c.targetFps = 60.0; } },
+        { "paced_60fps_mailbox", true, [](AppConfig& c) {
+            c.presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+            c.targetFps = 60.0;
+        } },
+    };
+
+    /* The stress mode finds out how many vertices per second the device sustains */
+    if (stress) {
+        scenarios.clear();
+        for (uint32_t instances : STRESS_INSTANCE_COUNTS)
+            scenarios.push_back({ "instances_" + std::to_string(instances), false,
+                                  [instances](AppConfig& c) { c.instanceCount = instances; } });
+    }
+
+    std::ostringstream results;
+    results << std::fixed << std::setprecision(4);
+    results << "{\n  \"headless\": " << (baseConfig.headless ? "true" : "false") << ",\n"
+            << "  \"scenarios\": [\n";
+
+    try {
+        bool first = true;
+        for (const auto& scenario : scenarios) {
+            if (scenario.needsWindow && baseConfig.headless) continue;
+
+            std::cerr << "Running " << scenario.name << " .. " << std::flush;
+            if (!first) results << ",\n";
+            runScenario(results, scenario, baseConfig);
+            first = false;
+            std::cerr << "done" << std::endl;
+        }
+    } catch(const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    results << "\n  ]\n}\n";
+
+    if (outputPath.empty())
+        std::cout << results.str();
+    else {
+        std::ofstream file(outputPath);
+        if (!file.is_open()) {
+            std::cerr << "Failed to open " << outputPath << std::endl;
+            return EXIT_FAILURE;
+        }
+        file << results.str();
+    }
+
+    return EXIT_SUCCESS;
+}
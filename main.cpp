@@ -1,9 +1,218 @@
 #include "HelloTriangle.hpp"
 
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <string>
 
-int main() {
-    HelloTriangleApplication app;
+/* Frames rendered in headless mode when no count is given, since there's no window to close */
+static const uint64_t DEFAULT_HEADLESS_FRAMES = 1000;
+
+/* Keep the pipeline cache in the user's cache directory, so it is found whatever directory the
+ * program is run from; empty (no cache) if there is no such directory */
+static std::string getDefaultPipelineCachePath() {
+    if (const char *cacheHome = std::getenv("XDG_CACHE_HOME"); cacheHome && cacheHome[0] == '/')
+        return std::string(cacheHome) + "/hello-triangle/pipeline.cache";
+    if (const char *home = std::getenv("HOME"); home && home[0] != '\0')
+        return std::string(home) + "/.cache/hello-triangle/pipeline.cache";
+    return {};
+}
+
+/* Map a profile name from the command line to a profile */
+static bool parseProfile(const char *name, PresentProfile& profile) {
+    if (strcmp(name, "low-latency") == 0)       profile = PresentProfile::LowLatency;
+    else if (strcmp(name, "balanced") == 0)     profile = PresentProfile::Balanced;
+    else if (strcmp(name, "throughput") == 0)   profile = PresentProfile::Throughput;
+    else if (strcmp(name, "power-saving") == 0) profile = PresentProfile::PowerSaving;
+    else return false;
+
+    return true;
+}
+
+/* Map blend and cull mode names from the command line to pipeline state */
+static bool parseBlendMode(const char *name, BlendMode& blend) {
+    if (strcmp(name, "opaque") == 0)        blend = BlendMode::Opaque;
+    else if (strcmp(name, "alpha") == 0)    blend = BlendMode::Alpha;
+    else if (strcmp(name, "additive") == 0) blend = BlendMode::Additive;
+    else return false;
+
+    return true;
+}
+
+static bool parseCullMode(const char *name, VkCullModeFlags& cullMode) {
+    if (strcmp(name, "none") == 0)       cullMode = VK_CULL_MODE_NONE;
+    else if (strcmp(name, "front") == 0) cullMode = VK_CULL_MODE_FRONT_BIT;
+    else if (strcmp(name, "back") == 0)  cullMode = VK_CULL_MODE_BACK_BIT;
+    else return false;
+
+    return true;
+}
+
+/* Map a sample count from the command line to its flag; it must be a power of two */
+static bool parseSampleCount(const char *text, VkSampleCountFlagBits& samples) {
+    unsigned long count = std::strtoul(text, nullptr, 10);
+    if (count == 0 || count > 64 || (count & (count - 1)) != 0) return false;
+
+    samples = static_cast<VkSampleCountFlagBits>(count);
+    return true;
+}
+
+/* Read a whole argument as a number no larger than max */
+static bool parseNumber(const char *text, unsigned long max, unsigned long& value) {
+    char *end = nullptr;
+    value = std::strtoul(text, &end, 10);
+    return end != text && *end == '\0' && text[0] != '-' && value <= max;
+}
+
+/* Map the fragment shader's color mode and output alpha from the command line; anything the
+ * variant's bytes can't hold, or the shader doesn't know, is rejected rather than wrapped */
+static bool parseColorMode(const char *text, uint8_t& colorMode) {
+    unsigned long mode;
+    if (!parseNumber(text, 2, mode)) return false;
+
+    colorMode = static_cast<uint8_t>(mode);
+    return true;
+}
+
+static bool parseAlpha(const char *text, uint8_t& alpha) {
+    unsigned long value;
+    if (!parseNumber(text, 255, value)) return false;
+
+    alpha = static_cast<uint8_t>(value);
+    return true;
+}
+
+static void printUsage(const char *program) {
+    std::cerr
+        << "Usage: " << program << " [options]\n"
+        << "  --headless       Render offscreen without a window or swap chain\n"
+        << "  --frames <n>     Stop after n frames\n"
+        << "  --profile <name> Start with a presentation profile: low-latency, balanced,\n"
+        << "                   throughput or power-saving (keys 1-4 switch at runtime)\n"
+        << "  --fps <n>        Pace frames to n per second, sleeping instead of drawing frames\n"
+        << "                   that would never be shown\n"
+        << "  --pipeline-cache <path>\n"
+        << "                   Persist the pipeline cache at path (empty to disable; by\n"
+        << "                   default in $XDG_CACHE_HOME/hello-triangle)\n"
+        << "  --shader-dir <path>\n"
+        << "                   Map the .spv files from path instead of the embedded shaders\n"
+        << "  --blend <mode>   Blend mode: opaque, alpha or additive\n"
+        << "  --cull <mode>    Cull mode: none, front or back\n"
+        << "  --color-mode <n> 0 = vertex colors, 1 = grayscale, 2 = inverted\n"
+        << "  --alpha <n>      Output alpha, 0-255\n"
+        << "  --msaa <n>       Samples per pixel (1, 2, 4, 8...), capped to what the GPU supports\n"
+        << "  --prewarm-pipelines\n"
+        << "                   Build the other blend and cull variants in the background\n"
+        << "  --draws <n>      Record n draw calls per frame\n"
+        << "  --instances <n>  Draw n instances of the mesh per draw call\n"
+        << "  --animate        Move the instances with a compute pass on the async compute queue\n"
+        << "  --rerecord       Record command buffers every frame instead of once per image\n"
+        << "  --gpu-driven     Cull the instances in a compute pass and draw them indirectly\n"
+        << "  --record-threads <n>\n"
+        << "                   Threads recording draws (default: one per hardware thread)\n"
+        << "  --no-timeline    Pace frames with fences even if timeline semaphores are available\n"
+        << "  --no-dynamic-state\n"
+        << "                   Bake cull mode and topology into pipelines even if the device\n"
+        << "                   supports extended dynamic state\n"
+        << "  --no-dynamic-rendering\n"
+        << "                   Render through a render pass and framebuffers even if the device\n"
+        << "                   supports dynamic rendering\n"
+        << "  --host-allocator Serve the driver's host memory from our own pools\n"
+        << "  --host-memory-limit <MiB>\n"
+        << "                   Use our pools, failing allocations beyond this much memory\n"
+        << "  --capture <dir>  Write every captured frame into dir as a PPM file\n"
+        << "  --golden <dir>   Compare captured frames with the PPM files in dir and fail if any\n"
+        << "                   differs\n"
+        << "  --capture-every <n>\n"
+        << "                   Capture every nth frame (default: all of them)\n"
+        << "  --golden-tolerance <n>\n"
+        << "                   Largest difference per channel that still matches (default: 2)\n"
+        << "  --stats          Print frame timing percentiles when done\n"
+        << "  --stats-csv <path>\n"
+        << "                   Dump per-frame timings as CSV when done\n"
+        << std::endl;
+}
+
+int main(int argc, char **argv) {
+    AppConfig config;
+    config.pipelineCachePath = getDefaultPipelineCachePath();
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--headless") == 0)
+            config.headless = true;
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            config.frameCount = std::strtoull(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc &&
+                parseProfile(argv[i + 1], config.presentProfile))
+            ++i;
+        else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+            config.targetFps = std::strtod(argv[++i], nullptr);
+        else if (strcmp(argv[i], "--pipeline-cache") == 0 && i + 1 < argc)
+            config.pipelineCachePath = argv[++i];
+        else if (strcmp(argv[i], "--shader-dir") == 0 && i + 1 < argc)
+            config.shaderDir = argv[++i];
+        else if (strcmp(argv[i], "--blend") == 0 && i + 1 < argc &&
+                parseBlendMode(argv[i + 1], config.pipelineVariant.blend))
+            ++i;
+        else if (strcmp(argv[i], "--cull") == 0 && i + 1 < argc &&
+                parseCullMode(argv[i + 1], config.pipelineVariant.cullMode))
+            ++i;
+        else if (strcmp(argv[i], "--color-mode") == 0 && i + 1 < argc &&
+                parseColorMode(argv[i + 1], config.pipelineVariant.colorMode))
+            ++i;
+        else if (strcmp(argv[i], "--alpha") == 0 && i + 1 < argc &&
+                parseAlpha(argv[i + 1], config.pipelineVariant.alpha))
+            ++i;
+        else if (strcmp(argv[i], "--msaa") == 0 && i + 1 < argc &&
+                parseSampleCount(argv[i + 1], config.pipelineVariant.samples))
+            ++i;
+        else if (strcmp(argv[i], "--prewarm-pipelines") == 0)
+            config.prewarmPipelines = true;
+        else if (strcmp(argv[i], "--draws") == 0 && i + 1 < argc)
+            config.drawCount = std::strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc)
+            config.instanceCount = std::strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--animate") == 0)
+            config.animateInstances = true;
+        else if (strcmp(argv[i], "--rerecord") == 0)
+            config.rerecordCommandBuffers = true;
+        else if (strcmp(argv[i], "--gpu-driven") == 0)
+            config.gpuDriven = true;
+        else if (strcmp(argv[i], "--record-threads") == 0 && i + 1 < argc)
+            config.recordThreads = std::strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--no-timeline") == 0)
+            config.allowTimelineSemaphore = false;
+        else if (strcmp(argv[i], "--no-dynamic-state") == 0)
+            config.allowExtendedDynamicState = false;
+        else if (strcmp(argv[i], "--no-dynamic-rendering") == 0)
+            config.allowDynamicRendering = false;
+        else if (strcmp(argv[i], "--host-allocator") == 0)
+            config.hostAllocator = true;
+        else if (strcmp(argv[i], "--host-memory-limit") == 0 && i + 1 < argc) {
+            config.hostAllocator = true;
+            config.hostMemoryLimit = size_t(std::strtoull(argv[++i], nullptr, 10)) << 20;
+        } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+            config.captureDir = argv[++i];
+        else if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc)
+            config.goldenDir = argv[++i];
+        else if (strcmp(argv[i], "--capture-every") == 0 && i + 1 < argc)
+            config.captureInterval = std::strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--golden-tolerance") == 0 && i + 1 < argc)
+            config.goldenTolerance = std::strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--stats") == 0)
+            config.printStats = true;
+        else if (strcmp(argv[i], "--stats-csv") == 0 && i + 1 < argc)
+            config.statsCsvPath = argv[++i];
+        else {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (config.headless && config.frameCount == 0)
+        config.frameCount = DEFAULT_HEADLESS_FRAMES;
+
+    HelloTriangleApplication app(config);
 
     try {
         app.run();